@@ -0,0 +1,143 @@
+#include "backlog_store.h"
+#include <mutex>
+
+size_t
+hashCombine(size_t seed, size_t val)
+{
+  return seed ^ (val + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+size_t
+hashBacklog(const Backlog& log)
+{
+  size_t ret = log.size();
+  for(auto& tape : log) {
+    ret = hashCombine(ret, tape.size());
+  }
+  for(auto& tape : log) {
+    for(auto sym : tape) {
+      ret = hashCombine(ret, sym.i);
+    }
+  }
+  return ret;
+}
+
+bool
+backlogEmpty(const Backlog& log)
+{
+  for(auto& tape : log) {
+    if(!tape.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+BacklogStore::BacklogStore(size_t tapes_) :
+  tapes(tapes_)
+{
+  offsets.push_back(0);
+  data.resize(tapes, 0);
+  offsets.push_back(data.size());
+}
+
+bool
+BacklogStore::matches(backlog_id id, const Backlog& log) const
+{
+  size_t loc = offsets[id];
+  for(auto& tape : log) {
+    if(data[loc++] != tape.size()) {
+      return false;
+    }
+  }
+  for(auto& tape : log) {
+    for(auto sym : tape) {
+      if(data[loc++] != sym.i) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool
+BacklogStore::find(size_t hash, const Backlog& log, backlog_id& id) const
+{
+  auto range = index.equal_range(hash);
+  for(auto it = range.first; it != range.second; ++it) {
+    if(matches(it->second, log)) {
+      id = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+backlog_id
+BacklogStore::intern(const Backlog& log)
+{
+  if(backlogEmpty(log)) {
+    return EMPTY;
+  }
+  size_t hash = hashBacklog(log);
+  backlog_id id;
+  {
+    std::shared_lock<std::shared_mutex> read(lock);
+    if(find(hash, log, id)) {
+      return id;
+    }
+  }
+  std::unique_lock<std::shared_mutex> write(lock);
+  if(find(hash, log, id)) {
+    return id;
+  }
+  id = (backlog_id)(offsets.size() - 1);
+  for(auto& tape : log) {
+    data.push_back((unsigned int)tape.size());
+  }
+  for(auto& tape : log) {
+    for(auto sym : tape) {
+      data.push_back(sym.i);
+    }
+  }
+  offsets.push_back(data.size());
+  index.insert(std::make_pair(hash, id));
+  return id;
+}
+
+void
+BacklogStore::load(backlog_id id, Backlog& log) const
+{
+  log.resize(tapes);
+  for(auto& tape : log) {
+    tape.clear();
+  }
+  if(id == EMPTY) {
+    return;
+  }
+  std::shared_lock<std::shared_mutex> read(lock);
+  size_t loc = offsets[id] + tapes;
+  for(size_t i = 0; i < tapes; i++) {
+    size_t len = data[offsets[id] + i];
+    for(size_t j = 0; j < len; j++) {
+      log[i].push_back(string_ref(data[loc++]));
+    }
+  }
+}
+
+size_t
+BacklogStore::tapeLength(backlog_id id, size_t tape) const
+{
+  if(id == EMPTY) {
+    return 0;
+  }
+  std::shared_lock<std::shared_mutex> read(lock);
+  return data[offsets[id] + tape];
+}
+
+size_t
+BacklogStore::size() const
+{
+  std::shared_lock<std::shared_mutex> read(lock);
+  return offsets.size() - 1;
+}
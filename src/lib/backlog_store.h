@@ -0,0 +1,41 @@
+#ifndef _LIB_BACKLOG_STORE_H_
+#define _LIB_BACKLOG_STORE_H_
+
+#include "symbol_table.h"
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+typedef std::vector<std::deque<string_ref>> Backlog;
+typedef uint32_t backlog_id;
+
+size_t hashCombine(size_t seed, size_t val);
+
+// Hash-consed store of immutable backlogs.
+// Each distinct backlog is stored once in a flat arena as the length of
+// each tape followed by the symbols of each tape, and is referred to by
+// its index. Id 0 is always the backlog with every tape empty.
+// All methods may be called from several threads at once.
+class BacklogStore {
+private:
+  size_t tapes;
+  std::vector<unsigned int> data;
+  std::vector<size_t> offsets;
+  std::unordered_multimap<size_t, backlog_id> index;
+  mutable std::shared_mutex lock;
+
+  bool find(size_t hash, const Backlog& log, backlog_id& id) const;
+  bool matches(backlog_id id, const Backlog& log) const;
+public:
+  static const backlog_id EMPTY = 0;
+
+  BacklogStore(size_t tapes);
+  backlog_id intern(const Backlog& log);
+  void load(backlog_id id, Backlog& log) const;
+  size_t tapeLength(backlog_id id, size_t tape) const;
+  size_t size() const;
+};
+
+#endif
@@ -1,7 +1,23 @@
 #include "compose.h"
+#include "compose_spill.h"
+#include "io.h"
+#include "shortest_distance.h"
+#include "utils/compression.h"
+#include "utils/tape_count.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <stdexcept>
 #include <deque>
 #include <map>
+#include <queue>
+#include <string>
+#include <thread>
+#include <sys/resource.h>
 
 #include <iostream>
 #include <unicode/ustream.h>
@@ -10,22 +26,8 @@ std::ostream&
 operator<<(std::ostream& s, const ComposedState& next)
 {
   s << "(" << next.left_state << ", " << next.right_state << ") -> " << next.out_state;// << std::endl;
-  s << " left_backlog: ";
-  for(auto log : next.left_backlog) {
-    s << "[";
-    for(auto it : log) {
-      s << it.i << ", ";
-    }
-    s << "] ";
-  }
-  s << "right_backlog: ";
-  for(auto log : next.right_backlog) {
-    s << "[";
-    for(auto it : log) {
-      s << it.i << ", ";
-    }
-    s << "] ";
-  }
+  s << " left_backlog: " << next.left_backlog;
+  s << " right_backlog: " << next.right_backlog;
   return s;
 }
 
@@ -38,57 +40,41 @@ operator<<(std::ostream& s, const Transition& tr)
   return s;
 }
 
-bool
-operator==(const std::deque<string_ref>& a, const std::deque<string_ref>& b)
+size_t
+std::hash<ComposedStateKey>::operator()(const ComposedStateKey& k) const
 {
-  if(a.size() != b.size()) {
-    return false;
-  }
-  for(size_t i = 0; i < a.size(); i++) {
-    if(a[i] != b[i]) {
-      return false;
-    }
-  }
-  return true;
+  size_t ret = hashCombine(k.left_state, k.right_state);
+  ret = hashCombine(ret, k.left_backlog);
+  ret = hashCombine(ret, k.right_backlog);
+  ret = hashCombine(ret, k.filter_state);
+  return hashCombine(ret, k.flag_register);
 }
 
-bool
-operator==(const std::vector<std::deque<string_ref>>& a, const std::vector<std::deque<string_ref>>& b)
+string_ref
+updateSymbol(const std::vector<string_ref>& update, string_ref sym)
 {
-  if(a.size() != b.size()) {
-    return false;
-  }
-  for(size_t i = 0; i < a.size(); i++) {
-    if(!(a[i] == b[i])) {
-      return false;
-    }
+  if(update.empty()) {
+    return sym;
   }
-  return true;
+  return (sym.i < update.size() ? update[sym.i] : string_ref(0));
 }
 
 bool
-backlogEmpty(const std::vector<std::deque<string_ref>>& log)
+isIdentityUpdate(const std::vector<string_ref>& update)
 {
-  for(auto it : log) {
-    if(!it.empty()) {
+  for(size_t i = 0; i < update.size(); i++) {
+    if(update[i].i != i) {
       return false;
     }
   }
   return true;
 }
 
-bool
-backlogEmpty(const ComposedState& s)
-{
-  return backlogEmpty(s.left_backlog) && backlogEmpty(s.right_backlog);
-}
-
 string_ref
-stepBacklog(std::deque<string_ref>& backlog, std::map<string_ref, string_ref>& update, string_ref sym)
+stepBacklog(std::deque<string_ref>& backlog, const std::vector<string_ref>& update, string_ref sym)
 {
   if(sym != string_ref(0)) {
-    string_ref up = (update.empty() ? sym : update[sym]);
-    backlog.push_back(up);
+    backlog.push_back(updateSymbol(update, sym));
   }
   string_ref ret = string_ref(0);
   if(!backlog.empty()) {
@@ -98,42 +84,87 @@ stepBacklog(std::deque<string_ref>& backlog, std::map<string_ref, string_ref>& u
   return ret;
 }
 
+template<typename L, typename R>
 bool
-Composer::composeTransition(Transition& l, Transition& r, ComposedState* state, Transition* out)
+Composer::composeTransitionT(ComposeScratch& w, const TransitionView& l, const TransitionView& r, Transition* out) const
 {
-  SymbolTable& table = t->getAlphabet();
+  // Identities can only be filled in if all the right symbols in this
+  // step come from r itself rather than from the backlog.
+  bool direct = rightIdentities;
+  for(size_t i = 0; direct && i < R::count(r.symbols.size()); i++) {
+    direct = w.right_backlog[i].empty();
+  }
+  // The same goes for identities on the left, which refer to the
+  // tapes of a, and so to the same tapes of t.
+  bool left_direct = leftIdentities;
+  for(size_t i = 0; left_direct && i < L::count(l.symbols.size()); i++) {
+    left_direct = w.left_backlog[i].empty();
+  }
   out->weight = l.weight + r.weight;
-  for(size_t i = 0; i < l.symbols.size(); i++) {
-    out->symbols[i] = stepBacklog(state->left_backlog[i], left_update, l.symbols[i]);
+  for(size_t i = 0; i < L::count(l.symbols.size()); i++) {
+    out->symbols[i] = stepBacklog(w.left_backlog[i], left_update, l.symbols[i]);
+  }
+  if(left_direct) {
+    for(size_t i = 0; i < L::count(l.symbols.size()); i++) {
+      string_ref sym = out->symbols[i];
+      if(matcher.isIdentity(sym) && matcher.identityTape(sym) < L::count(l.symbols.size())) {
+        string_ref ref = out->symbols[matcher.identityTape(sym)];
+        if(!matcher.isEpsilon(ref) && !matcher.isSet(ref) && !matcher.isIdentity(ref)) {
+          out->symbols[i] = ref;
+        }
+      }
+    }
   }
-  for(size_t i = 0; i < r.symbols.size(); i++) {
-    string_ref rsym = stepBacklog(state->right_backlog[i], right_update, r.symbols[i]);
+  for(size_t i = 0; i < R::count(r.symbols.size()); i++) {
+    string_ref rsym = stepBacklog(w.right_backlog[i], right_update, r.symbols[i]);
     size_t loc = placement[i];
-    if(loc >= l.symbols.size()) {  // not composing
+    if(loc >= L::count(l.symbols.size())) {  // not composing
       out->symbols[loc] = rsym;
       continue;
     } else if(rsym == out->symbols[loc]) {  // simple equality
       continue;
-    } else if(table.isEpsilon(out->symbols[loc], flagsAsEpsilon)) {  // left epsilon
-      state->right_backlog[i].push_front(rsym);
-    } else if(table.isEpsilon(rsym, flagsAsEpsilon)) {  // right epsilon
-      state->left_backlog[loc].push_front(out->symbols[loc]);
+    } else if(matcher.isEpsilon(out->symbols[loc])) {  // left epsilon
+      w.right_backlog[i].push_front(rsym);
+    } else if(matcher.isEpsilon(rsym)) {  // right epsilon
+      w.left_backlog[loc].push_front(out->symbols[loc]);
       out->symbols[loc] = rsym; // rsym might be a flag, so keep it
+    } else if(matcher.matches(rsym, out->symbols[loc])) {  // right is a set
+      continue;
+    } else if(matcher.matches(out->symbols[loc], rsym)) {  // left is a set
+      out->symbols[loc] = rsym;
+    } else if(left_direct && matcher.isIdentity(out->symbols[loc]) &&
+              matcher.identityTape(out->symbols[loc]) < L::count(l.symbols.size()) &&
+              matcher.matches(out->symbols[matcher.identityTape(out->symbols[loc])], rsym)) {
+      // left is an identity of a set, which now has to be rsym as well
+      out->symbols[matcher.identityTape(out->symbols[loc])] = rsym;
+      out->symbols[loc] = rsym;
     } else {  // failed to match
-      if(table.isDefined(rsym)) {
-        auto exp = table.lookup(rsym);
-        if(exp.type == UnionSymbol &&
-           exp.syms.find(out->symbols[loc]) != exp.syms.end()) {
-          continue;
+      return false;
+    }
+  }
+  if(direct) {
+    for(size_t i = 0; i < R::count(r.symbols.size()); i++) {
+      string_ref sym = out->symbols[placement[i]];
+      if(matcher.isIdentity(sym) && matcher.identityTape(sym) < tapeCount) {
+        string_ref ref = out->symbols[matcher.identityTape(sym)];
+        if(!matcher.isEpsilon(ref) && !matcher.isSet(ref) && !matcher.isIdentity(ref)) {
+          out->symbols[placement[i]] = ref;
         }
       }
-      return false;
     }
   }
   return true;
 }
 
-Composer::Composer(Transducer* a_, Transducer* b_, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon_)
+Composer::Composer(const TransducerView* a_, const TransducerView* b_, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon_, ComposeFilter filter_) :
+  filter(filter_),
+  left_logs(a_->getTapeCount()),
+  right_logs(b_->getTapeCount()),
+  merged(false),
+  join(AutoJoin),
+  state_count(0),
+  arc_count(0),
+  longest_backlog(0)
 {
   a = a_;
   b = b_;
@@ -145,21 +176,22 @@ Composer::Composer(Transducer* a_, Transducer* b_, std::vector<std::pair<Unicode
   tapeCount = a->getTapeCount() + b->getTapeCount() - tapes.size();
 
   std::vector<int> placement_temp = std::vector<int>(b->getTapeCount(), -1);
-  auto left_tapes = a->getTapeInfo();
-  auto right_tapes = b->getTapeInfo();
+  const auto& left_tapes = a->getTapeInfo();
+  const auto& right_tapes = b->getTapeInfo();
   std::map<UnicodeString, TapeInfo> mergedTapeInfo = left_tapes;
-  for(auto names : tapes) {
-    if(left_tapes.find(names.first) == left_tapes.end() ||
-       right_tapes.find(names.second) == right_tapes.end()) {
+  for(auto& names : tapes) {
+    auto linfo = left_tapes.find(names.first);
+    auto rinfo = right_tapes.find(names.second);
+    if(linfo == left_tapes.end() || rinfo == right_tapes.end()) {
       throw std::runtime_error("Attempt to compose along non-existent tapes");
     }
-    size_t ltape = left_tapes[names.first].index;
-    size_t rtape = right_tapes[names.second].index;
+    size_t ltape = linfo->second.index;
+    size_t rtape = rinfo->second.index;
     placement_temp[rtape] = ltape;
     if(mergedTapeInfo.find(names.second) == mergedTapeInfo.end()) {
       TapeInfo info;
       info.index = ltape;
-      info.flags = left_tapes[names.first].flags | right_tapes[names.second].flags;
+      info.flags = linfo->second.flags | rinfo->second.flags;
       mergedTapeInfo[names.second] = info;
       // TODO: the flags are probably going to end up wrong in several places
     }
@@ -172,7 +204,14 @@ Composer::Composer(Transducer* a_, Transducer* b_, std::vector<std::pair<Unicode
     }
     placement.push_back((size_t)placement_temp[i]);
   }
-  for(auto it : right_tapes) {
+  matchTape = placement.size();
+  for(size_t i = 0; i < placement.size(); i++) {
+    if(placement[i] < a->getTapeCount()) {
+      matchTape = i;
+      break;
+    }
+  }
+  for(auto& it : right_tapes) {
     if(mergedTapeInfo.find(it.first) == mergedTapeInfo.end()) {
       TapeInfo info;
       info.index = (size_t)placement[it.second.index];
@@ -183,67 +222,547 @@ Composer::Composer(Transducer* a_, Transducer* b_, std::vector<std::pair<Unicode
 
   t = new Transducer(tapeCount);
   t->setTapeInfo(mergedTapeInfo);
-  left_update = t->getAlphabet().merge(a->getAlphabet());
-  right_update = t->getAlphabet().merge(b->getAlphabet());
+  std::shared_ptr<SymbolTable> shared = a->getSharedAlphabet();
+  if(shared && shared == b->getSharedAlphabet()) {
+    t->shareAlphabet(shared);
+  } else {
+    left_update = t->getAlphabet().merge(a->getAlphabet());
+    right_update = t->getAlphabet().merge(b->getAlphabet());
+  }
+  leftIdentities = false;
+  for(auto& it : a->getAlphabet().getDefined()) {
+    if(it.second.type == IdentitySymbol && it.second.tape < a->getTapeCount()) {
+      leftIdentities = true;
+      break;
+    }
+  }
+  // identities on the right refer to tapes of b,
+  // so they need to be renumbered to refer to tapes of t
+  // (b may share its alphabet with t, so collect them before adding any)
+  rightIdentities = false;
+  std::vector<std::pair<string_ref, size_t>> identities;
+  for(auto& it : b->getAlphabet().getDefined()) {
+    if(it.second.type == IdentitySymbol && it.second.tape < placement.size()) {
+      identities.push_back(std::make_pair(it.first, it.second.tape));
+    }
+  }
+  size_t right_symbols = b->getAlphabet().getSymbols().size();
+  for(auto& it : identities) {
+    for(unsigned int i = (unsigned int)right_update.size(); i < right_symbols; i++) {
+      right_update.push_back(string_ref(i));
+    }
+    if(placement[it.second] != it.second) {
+      // a new identity symbol mustn't end up in the shared registry
+      t->unshareAlphabet();
+    }
+    right_update[it.first.i] = t->getAlphabet().makeIdentity(placement[it.second]);
+    rightIdentities = true;
+  }
+  // symbols which are already the same as in t don't need looking up
+  if(isIdentityUpdate(left_update)) {
+    left_update.clear();
+  }
+  if(isIdentityUpdate(right_update)) {
+    right_update.clear();
+  }
+  matcher = SymbolMatcher(t->getAlphabet(), flagsAsEpsilon);
+
+  left_epsilon.symbols = SymbolTuple(a->getTapeCount());
+  right_epsilon.symbols = SymbolTuple(b->getTapeCount());
+
+  dispatchTapes(a->getTapeCount(), [this](auto l) {
+    dispatchTapes(b->getTapeCount(), [this](auto r) {
+      typedef decltype(l) L;
+      typedef decltype(r) R;
+      isLeftEpsilonFn = &Composer::isLeftEpsilonT<L, R>;
+      isRightEpsilonFn = &Composer::isRightEpsilonT<L, R>;
+      composeTransitionFn = &Composer::composeTransitionT<L, R>;
+    });
+  });
+
+  for(auto& it : join_counts) {
+    it = 0;
+  }
+  // gathering statistics about a lazy input would compute all of it,
+  // so its statistics are left at their defaults
+  bool composing = (matchTape < placement.size());
+  if(!a->isLazy()) {
+    left_stats = gatherStats(a, composing ? placement[matchTape] : a->getTapeCount());
+  }
+  if(!b->isLazy()) {
+    right_stats = gatherStats(b, composing ? matchTape : b->getTapeCount());
+  }
+}
 
-  left_epsilon.symbols = std::vector<string_ref>(a->getTapeCount(), string_ref(0));
-  right_epsilon.symbols = std::vector<string_ref>(b->getTapeCount(), string_ref(0));
+OperandStats
+Composer::gatherStats(const TransducerView* t, size_t tape) const
+{
+  OperandStats stats;
+  stats.states = t->size();
+  stats.epsilon_density.assign(t->getTapeCount(), 0);
+  stats.deterministic = (tape < t->getTapeCount());
+  stats.sorted = stats.deterministic;
+  std::vector<string_ref> seen;
+  for(state_t src = 0; src < t->size(); src++) {
+    size_t fanout = 0;
+    seen.clear();
+    for(auto it = t->iterState(src); it != it.end(); ++it, fanout++) {
+      SymbolSpan syms = it.transition().symbols;
+      for(size_t i = 0; i < syms.size(); i++) {
+        if(syms[i] == string_ref(0)) {
+          stats.epsilon_density[i]++;
+        }
+      }
+      if(tape < syms.size()) {
+        seen.push_back(syms[tape]);
+      }
+    }
+    if(stats.sorted) {
+      stats.sorted = std::is_sorted(seen.begin(), seen.end());
+    }
+    if(stats.deterministic) {
+      std::sort(seen.begin(), seen.end());
+      stats.deterministic = (std::find(seen.begin(), seen.end(), string_ref(0)) == seen.end() &&
+                             std::adjacent_find(seen.begin(), seen.end()) == seen.end());
+    }
+    stats.arcs += fanout;
+    stats.max_fanout = std::max(stats.max_fanout, fanout);
+  }
+  for(auto& it : stats.epsilon_density) {
+    it = (stats.arcs == 0 ? 0 : it / (double)stats.arcs);
+  }
+  return stats;
+}
+
+ComposeJoin
+Composer::chooseJoin(size_t left_fanout, size_t right_fanout) const
+{
+  if(join != AutoJoin) {
+    return join;
+  }
+  // Rough costs in comparisons of symbols, where failing to compose
+  // a pair of transitions costs about as much as PAIR comparisons.
+  // A merge only has to sort the left transitions if they aren't in
+  // order already, and unless the right side is deterministic, runs of
+  // equal symbols on the right are visited more than once.
+  const double PAIR = 8;
+  double l = (double)left_fanout;
+  double r = (double)right_fanout;
+  double nested = PAIR * l * r;
+  double sort_right = r * std::log2(r + 1);
+  double index = sort_right + l * std::log2(r + 1);
+  double merge = sort_right + l + r;
+  if(!left_stats.sorted) {
+    merge += l * std::log2(l + 1);
+  }
+  if(!right_stats.deterministic) {
+    merge += l;
+  }
+  if(nested <= index && nested <= merge) {
+    return NestedLoopJoin;
+  }
+  return (index <= merge ? IndexedJoin : MergeJoin);
 }
 
 Composer::~Composer()
 {
 }
 
+void
+Composer::setLimits(const ComposeLimits& limits_)
+{
+  limits = limits_;
+}
+
+void
+Composer::setJoin(ComposeJoin join_)
+{
+  join = join_;
+}
+
+void
+Composer::keepTapes(const std::vector<UnicodeString>& names)
+{
+  const auto& info = t->getTapeInfo();
+  std::vector<bool> wanted(tapeCount, false);
+  for(auto& name : names) {
+    auto loc = info.find(name);
+    if(loc == info.end()) {
+      throw std::runtime_error("Attempt to keep non-existent tape");
+    }
+    wanted[loc->second.index] = true;
+  }
+  std::vector<size_t> renumber(tapeCount, tapeCount);
+  keep.clear();
+  for(size_t i = 0; i < tapeCount; i++) {
+    if(wanted[i]) {
+      renumber[i] = keep.size();
+      keep.push_back(i);
+    }
+  }
+  if(keep.size() == tapeCount) {
+    keep.clear();
+    return;
+  }
+
+  Transducer* projected = new Transducer(keep.size());
+  projected->copyAlphabet(t);
+  for(auto& it : info) {
+    if(wanted[it.second.index]) {
+      TapeInfo tape = it.second;
+      tape.index = renumber[tape.index];
+      projected->setTapeInfo(it.first, tape);
+    }
+  }
+  delete t;
+  t = projected;
+
+  keep_update.clear();
+  std::vector<std::pair<string_ref, size_t>> identities;
+  for(auto& it : t->getAlphabet().getDefined()) {
+    if(it.second.type == IdentitySymbol && it.second.tape < tapeCount) {
+      identities.push_back(std::make_pair(it.first, it.second.tape));
+    }
+  }
+  for(auto& it : identities) {
+    if(!wanted[it.second]) {
+      keep_update[it.first] = string_ref(0);
+    } else if(renumber[it.second] != it.second) {
+      t->unshareAlphabet();
+      keep_update[it.first] = t->getAlphabet().makeIdentity(renumber[it.second]);
+    }
+  }
+  matcher = SymbolMatcher(t->getAlphabet(), flagsAsEpsilon);
+}
+
+void
+Composer::evaluateFlags()
+{
+  flag_table = FlagTable(t->getAlphabet());
+  flag_registers = std::make_unique<FlagRegisterStore>(flag_table.featureCount());
+}
+
+bool
+Composer::applyFlags(ComposeScratch& w, const Transition& tr, ComposedState& next) const
+{
+  flag_registers->load(next.flag_register, w.flag_values);
+  for(size_t i = 0; i < tr.symbols.size(); i++) {
+    string_ref sym = tr.symbols[i];
+    if(!flag_table.isFlag(sym)) {
+      continue;
+    }
+    // a flag on several tapes of the same transition only counts once
+    if(std::find(tr.symbols.begin(), tr.symbols.begin() + (long)i, sym) != tr.symbols.begin() + (long)i) {
+      continue;
+    }
+    if(!applyFlag(flag_table.flag(sym), w.flag_values[flag_table.feature(sym)])) {
+      return false;
+    }
+  }
+  next.flag_register = flag_registers->intern(w.flag_values);
+  return true;
+}
+
+void
+Composer::project(Transition& tr) const
+{
+  SymbolTuple syms(keep.size());
+  for(size_t i = 0; i < keep.size(); i++) {
+    string_ref sym = tr.symbols[keep[i]];
+    auto loc = keep_update.find(sym);
+    if(loc != keep_update.end()) {
+      if(loc->second == string_ref(0)) {
+        throw std::runtime_error("Cannot drop a tape which an identity symbol on a kept tape refers to");
+      }
+      sym = loc->second;
+    }
+    syms[i] = sym;
+  }
+  tr.symbols = std::move(syms);
+}
+
+void
+Composer::removeDuplicateArcs(ComposeScratch& w) const
+{
+  if(w.arcs.size() < 2) {
+    return;
+  }
+  w.arc_hashes.clear();
+  for(size_t i = 0; i < w.arcs.size(); i++) {
+    size_t h = std::hash<ComposedStateKey>()(makeKey(w.arcs[i].first));
+    for(auto sym : w.arcs[i].second.symbols) {
+      h = hashCombine(h, sym.i);
+    }
+    w.arc_hashes.push_back(std::make_pair(h, i));
+  }
+  std::sort(w.arc_hashes.begin(), w.arc_hashes.end());
+  w.duplicate.assign(w.arcs.size(), false);
+  for(size_t start = 0; start < w.arc_hashes.size(); ) {
+    size_t end = start + 1;
+    while(end < w.arc_hashes.size() && w.arc_hashes[end].first == w.arc_hashes[start].first) {
+      end++;
+    }
+    // sorted by index within the run, so the first occurrence is kept
+    for(size_t x = start + 1; x < end; x++) {
+      auto& later = w.arcs[w.arc_hashes[x].second];
+      for(size_t y = start; y < x; y++) {
+        auto& earlier = w.arcs[w.arc_hashes[y].second];
+        if(!w.duplicate[w.arc_hashes[y].second] && later.second == earlier.second &&
+           makeKey(later.first) == makeKey(earlier.first)) {
+          w.duplicate[w.arc_hashes[x].second] = true;
+          break;
+        }
+      }
+    }
+    start = end;
+  }
+  size_t out = 0;
+  for(size_t i = 0; i < w.arcs.size(); i++) {
+    if(!w.duplicate[i]) {
+      if(out != i) {
+        w.arcs[out] = std::move(w.arcs[i]);
+      }
+      out++;
+    }
+  }
+  w.arcs.resize(out);
+}
+
+ComposePlan
+Composer::getPlan() const
+{
+  ComposePlan plan;
+  plan.left = left_stats;
+  plan.right = right_stats;
+  plan.join = join;
+  plan.nested = join_counts[NestedLoopJoin];
+  plan.indexed = join_counts[IndexedJoin];
+  plan.merged = join_counts[MergeJoin];
+  return plan;
+}
+
+size_t
+peakMemory()
+{
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;
+#else
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+ComposeStats
+Composer::getStats()
+{
+  std::lock_guard<std::mutex> guard(stats_lock);
+  stats.states = state_count;
+  stats.arcs = arc_count;
+  stats.memory = peakMemory();
+  return stats;
+}
+
+void
+Composer::noteBacklog(const ComposedState& s, size_t length, bool right, size_t tape)
+{
+  std::lock_guard<std::mutex> guard(stats_lock);
+  if(length <= longest_backlog) {
+    return;
+  }
+  longest_backlog = length;
+  stats.backlog = length;
+  stats.backlog_left_state = s.left_state;
+  stats.backlog_right_state = s.right_state;
+  stats.backlog_right = right;
+  stats.backlog_tape = tape;
+  if(limits.backlog != 0 && length > limits.backlog) {
+    limitExceeded(std::to_string(limits.backlog) + " symbols in a backlog");
+  }
+}
+
+void
+Composer::limitExceeded(const std::string& what)
+{
+  stats.states = state_count;
+  stats.arcs = arc_count;
+  stats.memory = peakMemory();
+  std::string msg = "Composition exceeded the limit of " + what;
+  msg += " after " + std::to_string(stats.states) + " states and ";
+  msg += std::to_string(stats.arcs) + " transitions";
+  if(stats.backlog > 0) {
+    const TransducerView* side = (stats.backlog_right ? b : a);
+    std::string name;
+    for(auto& it : side->getTapeInfo()) {
+      if(it.second.index == stats.backlog_tape) {
+        it.first.toUTF8String(name);
+        break;
+      }
+    }
+    msg += ". The longest backlog has " + std::to_string(stats.backlog);
+    msg += " symbols on tape '" + name + "' of the ";
+    msg += (stats.backlog_right ? "right" : "left");
+    msg += " transducer, at states (" + std::to_string(stats.backlog_left_state);
+    msg += ", " + std::to_string(stats.backlog_right_state) + ")";
+  }
+  throw ComposeLimitError(msg, stats);
+}
+
+void
+Composer::checkLimits(size_t states)
+{
+  state_count = states;
+  if(limits.states != 0 && states > limits.states) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    limitExceeded(std::to_string(limits.states) + " states");
+  }
+  if(limits.arcs != 0 && arc_count > limits.arcs) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    limitExceeded(std::to_string(limits.arcs) + " transitions");
+  }
+  // getrusage() is cheap, but not so cheap as to call for every state
+  if(limits.memory != 0 && states % 256 == 0 && peakMemory() > limits.memory) {
+    std::lock_guard<std::mutex> guard(stats_lock);
+    limitExceeded(std::to_string(limits.memory / (1024*1024)) + "MB of memory");
+  }
+}
+
 bool
-Composer::processTransitionPair(ComposedState& state, Transition& left, Transition& right, state_t lstate, state_t rstate)
+Composer::processTransitionPair(ComposeScratch& w, const ComposedState& state, const TransitionView& left, const TransitionView& right, state_t lstate, state_t rstate, unsigned char filter_state)
 {
   ComposedState next = state;
   next.left_state = lstate;
   next.right_state = rstate;
+  next.filter_state = filter_state;
+  left_logs.load(state.left_backlog, w.left_backlog);
+  right_logs.load(state.right_backlog, w.right_backlog);
   Transition tr;
   tr.symbols.resize(tapeCount);
 
   //std::cerr << "processTransitionPair\n\tnext = " << next << "\n\tleft = " << left << "\n\tright = " << right << std::endl;
 
-  if(composeTransition(left, right, &next, &tr)) {
+  if(composeTransition(w, left, right, &tr)) {
     //std::cerr << "\tmatched" << std::endl;
     //std::cerr << "\t-> " << tr << std::endl;
-    if(done_list.find(lstate) != done_list.end() &&
-       done_list[lstate].find(rstate) != done_list[lstate].end())
-    {
-      for(auto it : done_list[lstate][rstate]) {
-        if(it.left_backlog == next.left_backlog &&
-           it.right_backlog == next.right_backlog)
-        {
-          t->insertTransition(state.out_state, it.out_state, tr);
-          return true;
-        }
+    next.left_backlog = left_logs.intern(w.left_backlog);
+    next.right_backlog = right_logs.intern(w.right_backlog);
+    for(size_t i = 0; i < w.left_backlog.size(); i++) {
+      if(w.left_backlog[i].size() > longest_backlog) {
+        noteBacklog(next, w.left_backlog[i].size(), false, i);
       }
     }
-    next.out_state = t->insertTransition(state.out_state, tr);
-    done_list[lstate][rstate].push_back(next);
-    todo_list.push_back(next);
+    for(size_t i = 0; i < w.right_backlog.size(); i++) {
+      if(w.right_backlog[i].size() > longest_backlog) {
+        noteBacklog(next, w.right_backlog[i].size(), true, i);
+      }
+    }
+    if(flag_registers && !applyFlags(w, tr, next)) {
+      return true;
+    }
+    if(!keep.empty()) {
+      project(tr);
+    }
+    arc_count.fetch_add(1, std::memory_order_relaxed);
+    w.arcs.push_back(std::make_pair(next, tr));
     return true;
   }
   return false;
 }
 
+ComposedStateKey
+Composer::makeKey(const ComposedState& s) const
+{
+  ComposedStateKey key;
+  key.left_state = s.left_state;
+  key.right_state = s.right_state;
+  key.left_backlog = s.left_backlog;
+  key.right_backlog = s.right_backlog;
+  key.filter_state = s.filter_state;
+  key.flag_register = s.flag_register;
+  return key;
+}
+
+void
+Composer::indexRightTransitions(ComposeScratch& w) const
+{
+  w.right_index.clear();
+  w.right_wild.clear();
+  for(size_t i = 0; i < w.right_trans.size(); i++) {
+    string_ref sym = updateSymbol(right_update, w.right_trans[i].second.symbols[matchTape]);
+    if(matcher.isEpsilon(sym) || matcher.isSet(sym)) {
+      w.right_wild.push_back(i);
+    } else {
+      w.right_index.push_back(std::make_pair(sym, i));
+    }
+  }
+  std::sort(w.right_index.begin(), w.right_index.end());
+}
+
+void
+Composer::mergeLeftTransitions(ComposeScratch& w, const ComposedState& cur) const
+{
+  w.left_syms.clear();
+  w.left_index.clear();
+  for(auto lit = a->iterState(cur.left_state); lit != lit.end(); ++lit) {
+    string_ref sym = updateSymbol(left_update, lit.transition().symbols[placement[matchTape]]);
+    if(!matcher.isEpsilon(sym) && !matcher.isSet(sym) && !matcher.isIdentity(sym)) {
+      w.left_index.push_back(std::make_pair(sym, w.left_syms.size()));
+    }
+    w.left_syms.push_back(sym);
+  }
+  if(!std::is_sorted(w.left_index.begin(), w.left_index.end())) {
+    std::sort(w.left_index.begin(), w.left_index.end());
+  }
+  w.left_match.assign(w.left_syms.size(), w.right_index.size());
+  size_t r = 0;
+  for(auto& it : w.left_index) {
+    while(r < w.right_index.size() && w.right_index[r].first < it.first) {
+      r++;
+    }
+    w.left_match[it.second] = r;
+  }
+}
+
+void
+Composer::matchCandidates(ComposeScratch& w, string_ref sym, size_t first) const
+{
+  // Merge the matching entries of right_index with right_wild so that
+  // the candidates are visited in the same order as right_trans.
+  auto it = w.right_index.begin() + (long)first;
+  auto wild = w.right_wild.begin();
+  w.candidates.clear();
+  while(it != w.right_index.end() && it->first == sym) {
+    while(wild != w.right_wild.end() && *wild < it->second) {
+      w.candidates.push_back(*wild);
+      ++wild;
+    }
+    w.candidates.push_back(it->second);
+    ++it;
+  }
+  w.candidates.insert(w.candidates.end(), wild, w.right_wild.end());
+}
+
+template<typename L, typename R>
 bool
-Composer::isLeftEpsilon(Transition& tr)
+Composer::isLeftEpsilonT(const TransitionView& tr) const
 {
-  for(auto loc : placement) {
-    if(loc < tr.symbols.size() && tr.symbols[loc] != string_ref(0)) {
+  for(size_t i = 0; i < R::count(placement.size()); i++) {
+    size_t loc = placement[i];
+    if(loc < L::count(tr.symbols.size()) && tr.symbols[loc] != string_ref(0)) {
       return false;
     }
   }
   return true;
 }
 
+template<typename L, typename R>
 bool
-Composer::isRightEpsilon(Transition& tr)
+Composer::isRightEpsilonT(const TransitionView& tr) const
 {
-  for(size_t i = 0; i < placement.size(); i++) {
-    if(placement[i] < a->getTapeCount() && tr.symbols[i] != string_ref(0)) {
+  for(size_t i = 0; i < R::count(placement.size()); i++) {
+    if(placement[i] < L::count(a->getTapeCount()) && tr.symbols[i] != string_ref(0)) {
       return false;
     }
   }
@@ -251,12 +770,12 @@ Composer::isRightEpsilon(Transition& tr)
 }
 
 bool
-Composer::backlogsOverlap(const ComposedState& s)
+Composer::backlogsOverlap(const ComposedState& s) const
 {
   for(size_t i = 0; i < placement.size(); i++) {
-    if(placement[i] < s.left_backlog.size()) {
-      if(s.left_backlog[placement[i]].size() > 0 &&
-         s.right_backlog[i].size() > 0) {
+    if(placement[i] < a->getTapeCount()) {
+      if(left_logs.tapeLength(s.left_backlog, placement[i]) > 0 &&
+         right_logs.tapeLength(s.right_backlog, i) > 0) {
         return true;
       }
     }
@@ -264,82 +783,721 @@ Composer::backlogsOverlap(const ComposedState& s)
   return false;
 }
 
-Transducer*
-Composer::compose()
+// Filter states:
+//   0: nothing taken since the last step where both sides moved
+//   1: the left side has taken an epsilon step alone
+//   2: the right side has taken an epsilon step alone
+// (SequenceFilter uses 1 to mean the right side has moved.)
+// If the other side has no epsilons to interleave, the state stays 0
+// to avoid splitting states for nothing.
+
+int
+Composer::leftEpsilonFilter(unsigned char fs, bool right_has_eps) const
+{
+  switch(filter) {
+    case SequenceFilter:
+      return (fs == 0 ? 0 : -1);
+    case MatchFilter:
+      if(fs == 2) {
+        return -1;
+      }
+      return (right_has_eps ? 1 : 0);
+    default:
+      return 0;
+  }
+}
+
+int
+Composer::rightEpsilonFilter(unsigned char fs, bool left_has_eps) const
+{
+  switch(filter) {
+    case SequenceFilter:
+      return (left_has_eps ? 1 : 0);
+    case MatchFilter:
+      if(fs == 1) {
+        return -1;
+      }
+      return (left_has_eps ? 2 : 0);
+    default:
+      return 0;
+  }
+}
+
+void
+Composer::expandState(ComposeScratch& w, const ComposedState& cur)
+{
+  w.final = false;
+  w.arcs.clear();
+  state_t lstate = cur.left_state;
+  state_t rstate = cur.right_state;
+  bool lempty = (cur.left_backlog == BacklogStore::EMPTY);
+  bool rempty = (cur.right_backlog == BacklogStore::EMPTY);
+
+  //std::cerr << std::endl << "cur = " << cur << std::endl;
+
+  if(backlogsOverlap(cur)) {
+    processTransitionPair(w, cur, left_epsilon, right_epsilon, lstate, rstate);
+    return;
+    // if we try to step by non-epsilon transitions when we have overlapping
+    // backogs, we just end up duplicating the effort
+  } else if(lempty && rempty &&
+            a->isFinal(cur.left_state) && b->isFinal(cur.right_state)) {
+    w.final = true;
+  }
+  bool filtered = (filter != TrivialFilter && lempty && rempty);
+  bool left_has_eps = false;
+  if(filtered) {
+    for(auto lit = a->iterState(cur.left_state); lit != lit.end(); ++lit) {
+      if(isLeftEpsilon(lit.transition())) {
+        left_has_eps = true;
+        break;
+      }
+    }
+  }
+  w.right_trans.clear();
+  w.right_eps.clear();
+  // right_trans and right_eps refer to transitions held by rit,
+  // so it has to last until the state has been expanded
+  TransitionIterator rit = b->iterState(cur.right_state);
+  for(; rit != rit.end(); ++rit) {
+    rstate = rit.target();
+    TransitionView rtrans = rit.transition();
+    if(filtered && isRightEpsilon(rtrans)) {
+      w.right_eps.push_back(std::make_pair(rstate, rtrans));
+      int fs = rightEpsilonFilter(cur.filter_state, left_has_eps);
+      if(fs != -1) {
+        processTransitionPair(w, cur, left_epsilon, rtrans, lstate, rstate, (unsigned char)fs);
+      }
+      continue;
+    }
+    if((!lempty || isRightEpsilon(rtrans)) &&
+       processTransitionPair(w, cur, left_epsilon, rtrans, lstate, rstate)) {
+      continue;
+      // see below for explanation of stepping by epsilon on the right
+      // this is just the mirror of that
+    }
+    w.right_trans.push_back(std::make_pair(rstate, rtrans));
+  }
+  // With nothing waiting in the backlogs on matchTape, the symbols
+  // there come straight from the transitions, so a pair can only
+  // match if the symbols are equal or one of them might match anything.
+  ComposeJoin how = NestedLoopJoin;
+  if(matchTape < placement.size() &&
+     left_logs.tapeLength(cur.left_backlog, placement[matchTape]) == 0 &&
+     right_logs.tapeLength(cur.right_backlog, matchTape) == 0) {
+    size_t left_fanout = 0;
+    for(auto lit = a->iterState(cur.left_state); lit != lit.end(); ++lit) {
+      left_fanout++;
+    }
+    how = chooseJoin(left_fanout, w.right_trans.size());
+  }
+  join_counts[how].fetch_add(1, std::memory_order_relaxed);
+  if(how != NestedLoopJoin) {
+    indexRightTransitions(w);
+  }
+  if(how == MergeJoin) {
+    mergeLeftTransitions(w, cur);
+  }
+  size_t li = 0;
+  for(auto lit = a->iterState(cur.left_state); lit != lit.end(); ++lit, li++) {
+    lstate = lit.target();
+    TransitionView ltrans = lit.transition();
+    rstate = cur.right_state;
+    if(filtered && isLeftEpsilon(ltrans)) {
+      int fs = leftEpsilonFilter(cur.filter_state, !w.right_eps.empty());
+      if(fs != -1) {
+        processTransitionPair(w, cur, ltrans, right_epsilon, lstate, rstate, (unsigned char)fs);
+      }
+      if(filter == MatchFilter && cur.filter_state == 0) {
+        for(auto& it : w.right_eps) {
+          processTransitionPair(w, cur, ltrans, it.second, lstate, it.first);
+        }
+      }
+      continue;
+    }
+    if(!rempty || isLeftEpsilon(ltrans)) {
+      if(processTransitionPair(w, cur, ltrans, right_epsilon, lstate, rstate)) {
+        continue;
+        // if stepping by epsilon on the right gets us somewhere
+        // then stepping by the next transition will just add to the
+        // backlog
+        // if the left has multiple epsilons in a row on the composing
+        // tape, then this results in symbols on non-composing tapes on
+        // the right being output when the corresponding composing symbol
+        // is output rather than creating duplicate paths for every
+        // possible position
+      }
+    }
+    string_ref lsym = string_ref(0);
+    if(how == IndexedJoin) {
+      lsym = updateSymbol(left_update, ltrans.symbols[placement[matchTape]]);
+    } else if(how == MergeJoin) {
+      lsym = w.left_syms[li];
+    }
+    // an identity stands for the symbol on another tape,
+    // so it has to be tried against every right transition
+    if(!matcher.isEpsilon(lsym) && !matcher.isSet(lsym) && !matcher.isIdentity(lsym)) {
+      size_t first;
+      if(how == MergeJoin) {
+        first = w.left_match[li];
+      } else {
+        first = (size_t)(std::lower_bound(w.right_index.begin(), w.right_index.end(),
+                                          std::make_pair(lsym, (size_t)0)) - w.right_index.begin());
+      }
+      matchCandidates(w, lsym, first);
+      for(auto idx : w.candidates) {
+        processTransitionPair(w, cur, ltrans, w.right_trans[idx].second, lstate, w.right_trans[idx].first);
+      }
+      continue;
+    }
+    for(auto& it : w.right_trans) {
+      processTransitionPair(w, cur, ltrans, it.second, lstate, it.first);
+    }
+  }
+  if(!keep.empty()) {
+    removeDuplicateArcs(w);
+  }
+}
+
+ComposedState
+Composer::initialState() const
 {
   ComposedState init;
   init.left_state = 0;
   init.right_state = 0;
   init.out_state = 0;
-  init.left_backlog.resize(a->getTapeCount());
-  init.right_backlog.resize(b->getTapeCount());
-  todo_list.push_back(init);
-  done_list[0][0].push_back(init);
+  init.left_backlog = BacklogStore::EMPTY;
+  init.right_backlog = BacklogStore::EMPTY;
+  init.filter_state = 0;
+  init.flag_register = FlagRegisterStore::UNSET;
+  return init;
+}
 
-  auto left_transitions = a->getTransitions();
-  auto right_transitions = b->getTransitions();
+Transducer*
+Composer::composeSerial()
+{
+  ComposeScratch w;
+  ComposedState init = initialState();
+  todo_list.push_back(init);
+  done_list[makeKey(init)] = 0;
+  expandAll(w);
+  return t;
+}
 
+void
+Composer::expandAll(ComposeScratch& w)
+{
   while(todo_list.size() > 0) {
-    ComposedState cur = todo_list.front();
+    const ComposedState cur = todo_list.front();
     todo_list.pop_front();
-    state_t lstate = cur.left_state;
-    state_t rstate = cur.right_state;
-    bool lempty = backlogEmpty(cur.left_backlog);
-    bool rempty = backlogEmpty(cur.right_backlog);
+    expandState(w, cur);
+    if(w.final) {
+      t->setFinal(cur.out_state);
+    }
+    for(auto& it : w.arcs) {
+      ComposedState& next = it.first;
+      ComposedStateKey key = makeKey(next);
+      auto loc = done_list.find(key);
+      if(loc != done_list.end()) {
+        t->insertTransition(cur.out_state, loc->second, it.second);
+        continue;
+      }
+      next.out_state = t->insertTransition(cur.out_state, it.second);
+      done_list[key] = next.out_state;
+      todo_list.push_back(next);
+    }
+    checkLimits(t->size());
+  }
+}
+
+void
+Composer::getProvenance(ComposeProvenance& provenance) const
+{
+  if(merged) {
+    throw std::logic_error("Provenance is not available once states have been merged");
+  }
+  provenance.states.assign(t->size(), initialState());
+  for(auto& it : done_list) {
+    ComposedState& s = provenance.states[it.second];
+    s.left_state = it.first.left_state;
+    s.right_state = it.first.right_state;
+    s.left_backlog = it.first.left_backlog;
+    s.right_backlog = it.first.right_backlog;
+    s.filter_state = it.first.filter_state;
+    s.flag_register = it.first.flag_register;
+    s.out_state = it.second;
+  }
+  provenance.left_backlogs.resize(left_logs.size());
+  for(backlog_id i = 0; i < left_logs.size(); i++) {
+    left_logs.load(i, provenance.left_backlogs[i]);
+  }
+  provenance.right_backlogs.resize(right_logs.size());
+  for(backlog_id i = 0; i < right_logs.size(); i++) {
+    right_logs.load(i, provenance.right_backlogs[i]);
+  }
+  provenance.flag_registers.clear();
+  if(flag_registers) {
+    provenance.flag_registers.resize(flag_registers->size());
+    for(flag_register_id i = 0; i < flag_registers->size(); i++) {
+      flag_registers->load(i, provenance.flag_registers[i]);
+    }
+  }
+}
+
+Transducer*
+Composer::recompose(const TransducerView* previous, const ComposeProvenance& provenance, const std::set<state_t>& changed)
+{
+  if(provenance.states.size() != previous->size()) {
+    throw std::invalid_argument("Provenance does not match the previous composition");
+  }
+  if(previous->size() == 0) {
+    // nothing to reuse
+    return composeSerial();
+  }
+  // previous may use symbols which have since gone from the inputs
+  std::vector<string_ref> update;
+  std::shared_ptr<SymbolTable> shared = t->getSharedAlphabet();
+  if(!shared || shared != previous->getSharedAlphabet()) {
+    t->unshareAlphabet();
+    update = t->getAlphabet().merge(previous->getAlphabet());
+  }
+  matcher = SymbolMatcher(t->getAlphabet(), flagsAsEpsilon);
+  std::vector<backlog_id> left_ids;
+  for(Backlog log : provenance.left_backlogs) {
+    for(auto& tape : log) {
+      for(auto& sym : tape) {
+        sym = updateSymbol(update, sym);
+      }
+    }
+    left_ids.push_back(left_logs.intern(log));
+  }
+  std::vector<backlog_id> right_ids;
+  for(Backlog log : provenance.right_backlogs) {
+    for(auto& tape : log) {
+      for(auto& sym : tape) {
+        sym = updateSymbol(update, sym);
+      }
+    }
+    right_ids.push_back(right_logs.intern(log));
+  }
 
-    //std::cerr << std::endl << "cur = " << cur << std::endl;
+  std::vector<flag_register_id> flag_ids;
+  if(flag_registers) {
+    for(auto& values : provenance.flag_registers) {
+      flag_ids.push_back(flag_registers->intern(values));
+    }
+  }
 
-    if(backlogsOverlap(cur)) {
-      processTransitionPair(cur, left_epsilon, right_epsilon, lstate, rstate);
+  ComposeScratch w;
+  const auto& finals = previous->getFinals();
+  if(previous->size() > t->size()) {
+    t->addStates(previous->size() - t->size());
+  }
+  Transition tr;
+  for(state_t src = 0; src < previous->size(); src++) {
+    ComposedState cur = provenance.states[src];
+    cur.left_backlog = left_ids[cur.left_backlog];
+    cur.right_backlog = right_ids[cur.right_backlog];
+    if(flag_registers) {
+      cur.flag_register = flag_ids.at(cur.flag_register);
+    }
+    cur.out_state = src;
+    done_list[makeKey(cur)] = src;
+    if(cur.left_state >= a->size()) {
+      // left state deleted, so this is now a dead end
+      continue;
+    } else if(changed.find(cur.left_state) != changed.end()) {
+      todo_list.push_back(cur);
       continue;
-      // if we try to step by non-epsilon transitions when we have overlapping
-      // backogs, we just end up duplicating the effort
-    } else if(lempty && rempty &&
-              a->isFinal(cur.left_state) && b->isFinal(cur.right_state)) {
-      t->setFinal(cur.out_state);
     }
-    std::vector<std::pair<state_t, Transition>> right_trans;
-    for(auto rvect : right_transitions[cur.right_state]) {
-      rstate = rvect.first;
-      for(auto rtrans : rvect.second) {
-        if((!lempty || isRightEpsilon(rtrans)) &&
-           processTransitionPair(cur, left_epsilon, rtrans, lstate, rstate)) {
-          continue;
-          // see below for explanation of stepping by epsilon on the right
-          // this is just the mirror of that
+    for(auto it = previous->iterState(src); it != it.end(); ++it) {
+      TransitionView old = it.transition();
+      tr.symbols.resize(old.symbols.size());
+      for(size_t i = 0; i < old.symbols.size(); i++) {
+        tr.symbols[i] = updateSymbol(update, old.symbols[i]);
+      }
+      tr.weight = old.weight;
+      t->insertTransition(src, it.target(), tr);
+    }
+    auto fin = finals.find(src);
+    if(fin != finals.end()) {
+      t->setFinal(src, fin->second);
+    }
+  }
+  expandAll(w);
+  return t;
+}
+
+// A state found by a worker thread, numbered in the order the
+// workers happened to find it.
+struct ExpandedState {
+  state_t id;
+  bool final;
+  std::vector<std::pair<state_t, Transition>> arcs;
+};
+
+struct ComposeWorkerQueue {
+  std::mutex lock;
+  std::deque<ComposedState> queue;
+  std::vector<ExpandedState> done;
+};
+
+struct ComposeStateShard {
+  std::mutex lock;
+  std::unordered_map<ComposedStateKey, state_t> states;
+};
+
+struct ParallelCompose {
+  std::vector<ComposeWorkerQueue> workers;
+  std::vector<ComposeStateShard> shards;
+  std::atomic<size_t> next_id;
+  // states which have been found but not yet expanded
+  std::atomic<size_t> pending;
+  std::atomic<bool> failed;
+  std::mutex error_lock;
+  std::exception_ptr error;
+
+  ParallelCompose(size_t threads) :
+    workers(threads), shards(threads * 16), next_id(0), pending(0), failed(false)
+  {}
+
+  // Returns the id of the state with this key, and whether it was new.
+  state_t lookup(const ComposedStateKey& key, bool& added)
+  {
+    ComposeStateShard& shard = shards[std::hash<ComposedStateKey>()(key) % shards.size()];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto loc = shard.states.try_emplace(key, 0);
+    added = loc.second;
+    if(added) {
+      loc.first->second = next_id++;
+    }
+    return loc.first->second;
+  }
+
+  void push(size_t self, const ComposedState& s)
+  {
+    std::lock_guard<std::mutex> guard(workers[self].lock);
+    workers[self].queue.push_back(s);
+  }
+
+  // Take the newest state from our own queue, or else the oldest
+  // state from someone else's.
+  bool take(size_t self, ComposedState& s)
+  {
+    for(size_t i = 0; i < workers.size(); i++) {
+      ComposeWorkerQueue& q = workers[(self + i) % workers.size()];
+      std::lock_guard<std::mutex> guard(q.lock);
+      if(q.queue.empty()) {
+        continue;
+      }
+      if(i == 0) {
+        s = q.queue.back();
+        q.queue.pop_back();
+      } else {
+        s = q.queue.front();
+        q.queue.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+};
+
+void
+Composer::composeWorker(ParallelCompose& p, size_t self)
+{
+  ComposeScratch w;
+  ComposedState cur;
+  try {
+    while(p.pending > 0 && !p.failed) {
+      if(!p.take(self, cur)) {
+        std::this_thread::yield();
+        continue;
+      }
+      expandState(w, cur);
+      ExpandedState exp;
+      exp.id = cur.out_state;
+      exp.final = w.final;
+      exp.arcs.reserve(w.arcs.size());
+      for(auto& it : w.arcs) {
+        ComposedState& next = it.first;
+        bool added;
+        next.out_state = p.lookup(makeKey(next), added);
+        if(added) {
+          p.pending++;
+          p.push(self, next);
         }
-        right_trans.push_back(std::make_pair(rstate, rtrans));
-      }
-    }
-    for(auto lvect : left_transitions[cur.left_state]) {
-      lstate = lvect.first;
-      for(auto ltrans : lvect.second) {
-        rstate = cur.right_state;
-        if(!rempty || isLeftEpsilon(ltrans)) {
-          if(processTransitionPair(cur, ltrans, right_epsilon, lstate, rstate)) {
-            continue;
-            // if stepping by epsilon on the right gets us somewhere
-            // then stepping by the next transition will just add to the
-            // backlog
-            // if the left has multiple epsilons in a row on the composing
-            // tape, then this results in symbols on non-composing tapes on
-            // the right being output when the corresponding composing symbol
-            // is output rather than creating duplicate paths for every
-            // possible position
-          }
+        exp.arcs.push_back(std::make_pair(next.out_state, it.second));
+      }
+      p.workers[self].done.push_back(std::move(exp));
+      p.pending--;
+      checkLimits(p.next_id);
+    }
+  } catch(...) {
+    std::lock_guard<std::mutex> guard(p.error_lock);
+    if(!p.failed) {
+      p.error = std::current_exception();
+      p.failed = true;
+    }
+  }
+}
+
+Transducer*
+Composer::composeParallel(size_t threads)
+{
+  ParallelCompose p(threads);
+  ComposedState init = initialState();
+  bool added;
+  init.out_state = p.lookup(makeKey(init), added);
+  p.pending++;
+  p.push(0, init);
+
+  std::vector<std::thread> pool;
+  for(size_t i = 0; i < threads; i++) {
+    pool.push_back(std::thread(&Composer::composeWorker, this, std::ref(p), i));
+  }
+  for(auto& it : pool) {
+    it.join();
+  }
+  if(p.failed) {
+    std::rethrow_exception(p.error);
+  }
+
+  // Replay the expansions breadth-first from the initial state, which
+  // numbers the states exactly as composeSerial() would.
+  std::vector<ExpandedState*> found(p.next_id, nullptr);
+  for(auto& worker : p.workers) {
+    for(auto& exp : worker.done) {
+      found[exp.id] = &exp;
+    }
+  }
+  const state_t unseen = found.size();
+  std::vector<state_t> renumber(found.size(), unseen);
+  std::vector<state_t> order;
+  renumber[0] = 0;
+  order.push_back(0);
+  for(size_t i = 0; i < order.size(); i++) {
+    ExpandedState* exp = found[order[i]];
+    state_t src = renumber[order[i]];
+    if(exp->final) {
+      t->setFinal(src);
+    }
+    for(auto& it : exp->arcs) {
+      if(renumber[it.first] != unseen) {
+        t->insertTransition(src, renumber[it.first], it.second);
+      } else {
+        renumber[it.first] = t->insertTransition(src, it.second);
+        order.push_back(it.first);
+      }
+    }
+    std::vector<std::pair<state_t, Transition>>().swap(exp->arcs);
+  }
+  return t;
+}
+
+Transducer*
+Composer::composePruned(double threshold)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  std::vector<double> left_dist = distanceToFinal(a);
+  std::vector<double> right_dist = distanceToFinal(b);
+  // lower bound on the weight from a composed state to a final state
+  std::vector<double> estimate;
+  // lightest known weight from the initial state
+  std::vector<double> reached;
+  std::vector<bool> expanded;
+  std::vector<ComposedState> states;
+  typedef std::pair<double, state_t> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> todo;
+
+  ComposeScratch w;
+  ComposedState init = initialState();
+  done_list[makeKey(init)] = 0;
+  states.push_back(init);
+  estimate.push_back(left_dist[0] + right_dist[0]);
+  reached.push_back(0);
+  expanded.push_back(false);
+  if(estimate[0] < inf) {
+    todo.push(std::make_pair(estimate[0], 0));
+  }
+
+  // becomes the weight of the lightest path plus the threshold
+  // as soon as that path is found
+  double bound = inf;
+  while(!todo.empty()) {
+    Entry top = todo.top();
+    todo.pop();
+    state_t id = top.second;
+    if(expanded[id] || top.first > reached[id] + estimate[id]) {
+      continue;
+    } else if(top.first > bound) {
+      break;
+    }
+    expanded[id] = true;
+    const ComposedState cur = states[id];
+    expandState(w, cur);
+    if(w.final) {
+      t->setFinal(id);
+      if(bound == inf) {
+        bound = reached[id] + threshold;
+      }
+    }
+    for(auto& it : w.arcs) {
+      ComposedState& next = it.first;
+      double h = left_dist[next.left_state] + right_dist[next.right_state];
+      double g = reached[id] + it.second.weight;
+      if(h == inf || g + h > bound) {
+        continue;
+      }
+      ComposedStateKey key = makeKey(next);
+      auto loc = done_list.find(key);
+      if(loc != done_list.end()) {
+        t->insertTransition(id, loc->second, it.second);
+        if(g < reached[loc->second]) {
+          reached[loc->second] = g;
+          todo.push(std::make_pair(g + h, loc->second));
         }
-        for(auto it : right_trans) {
-          processTransitionPair(cur, ltrans, it.second, lstate, it.first);
+        continue;
+      }
+      next.out_state = t->insertTransition(id, it.second);
+      done_list[key] = next.out_state;
+      states.push_back(next);
+      estimate.push_back(h);
+      reached.push_back(g);
+      expanded.push_back(false);
+      todo.push(std::make_pair(g + h, next.out_state));
+    }
+    checkLimits(states.size());
+  }
+
+  // Transitions added before the bound was known might still be too
+  // heavy, so check them now and then discard anything unreachable.
+  double slack = 1e-9 * std::max(1.0, std::abs(bound));
+  auto& trans = t->getTransitions();
+  for(state_t src = 0; src < trans.size(); src++) {
+    for(auto it = trans[src].begin(); it != trans[src].end(); ) {
+      auto& arcs = it->second;
+      for(size_t i = 0; i < arcs.size(); ) {
+        if(reached[src] + arcs[i].weight + estimate[it->first] > bound + slack) {
+          arcs.erase(arcs.begin() + (long)i);
+        } else {
+          i++;
         }
       }
+      if(arcs.empty()) {
+        it = trans[src].erase(it);
+      } else {
+        ++it;
+      }
     }
   }
+  t->trim();
+  if(!keep.empty()) {
+    t->mergeEquivalentStates();
+    merged = true;
+  }
+  return t;
+}
+
+void
+Composer::composeToFile(FILE* out, const std::string& spillDir, size_t memoryStates)
+{
+  // the same search as composeSerial(), so states are expanded in the
+  // order they are numbered and their transitions can be written as soon
+  // as they have been found
+  ComposeScratch w;
+  SpilledStateTable states(spillDir, memoryStates);
+  SpilledStateQueue todo(spillDir);
+  SpillFile arcs(spillDir);
+  std::vector<std::pair<state_t, Transition>> out_arcs;
+  ComposedState init = initialState();
+  todo.push(init);
+  states.insert(makeKey(init), 0);
+  size_t found = 1;
+
+  while(!todo.empty()) {
+    const ComposedState cur = todo.pop();
+    expandState(w, cur);
+    if(w.final) {
+      t->setFinal(cur.out_state);
+    }
+    out_arcs.clear();
+    for(auto& it : w.arcs) {
+      ComposedState& next = it.first;
+      ComposedStateKey key = makeKey(next);
+      if(!states.find(key, next.out_state)) {
+        next.out_state = found++;
+        states.insert(key, next.out_state);
+        todo.push(next);
+      }
+      out_arcs.push_back(std::make_pair(next.out_state, it.second));
+    }
+    // Transducer keeps the transitions of each state ordered by target
+    std::stable_sort(out_arcs.begin(), out_arcs.end(),
+                     [](const std::pair<state_t, Transition>& x, const std::pair<state_t, Transition>& y) {
+                       return x.first < y.first;
+                     });
+    writeBinState(out_arcs, arcs.handle());
+    checkLimits(found);
+  }
+
+  writeBinHeader(t, true, out);
+  Compression::multibyte_write(found, out);
+  arcs.copyTo(out);
+  // unlike the other methods, t is not handed to the caller
+  delete t;
+  t = NULL;
+}
+
+Transducer*
+Composer::compose(size_t threads)
+{
+  Transducer* ret = (threads > 1 ? composeParallel(threads) : composeSerial());
+  if(!keep.empty()) {
+    ret->mergeEquivalentStates();
+    merged = true;
+  }
+  return ret;
+}
+
+Transducer*
+compose(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon, ComposeFilter filter, size_t threads, const ComposeLimits& limits)
+{
+  Composer comp(a, b, tapes, flagsAsEpsilon, filter);
+  comp.setLimits(limits);
+  return comp.compose(threads);
+}
+
+void
+composeToFile(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, FILE* out, const std::string& spillDir, size_t memoryStates, bool flagsAsEpsilon, ComposeFilter filter, const ComposeLimits& limits)
+{
+  Composer comp(a, b, tapes, flagsAsEpsilon, filter);
+  comp.setLimits(limits);
+  comp.composeToFile(out, spillDir, memoryStates);
+}
+
+Transducer*
+composeWithProvenance(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, ComposeProvenance& provenance, bool flagsAsEpsilon, ComposeFilter filter)
+{
+  Composer comp(a, b, tapes, flagsAsEpsilon, filter);
+  Transducer* t = comp.compose();
+  comp.getProvenance(provenance);
+  return t;
+}
+
+Transducer*
+recompose(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, const TransducerView* previous, ComposeProvenance& provenance, const std::set<state_t>& changed, bool flagsAsEpsilon, ComposeFilter filter)
+{
+  Composer comp(a, b, tapes, flagsAsEpsilon, filter);
+  Transducer* t = comp.recompose(previous, provenance, changed);
+  comp.getProvenance(provenance);
   return t;
 }
 
 Transducer*
-compose(Transducer* a, Transducer* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon)
+composePruned(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, double threshold, bool flagsAsEpsilon, ComposeFilter filter, const ComposeLimits& limits)
 {
-  Composer comp(a, b, tapes, flagsAsEpsilon);
-  return comp.compose();
+  Composer comp(a, b, tapes, flagsAsEpsilon, filter);
+  comp.setLimits(limits);
+  return comp.composePruned(threshold);
 }
@@ -2,11 +2,22 @@
 #define _LIB_COMPOSE_H_
 
 #include "transducer.h"
+#include "backlog_store.h"
+#include "flags.h"
+#include "symbol_matcher.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <unicode/unistr.h>
 #include <map>
+#include <memory>
 #include <vector>
 #include <deque>
+#include <unordered_map>
 
 struct BacklogDependency {
   size_t source_tape;
@@ -15,42 +26,334 @@ struct BacklogDependency {
   size_t reference_index;
 };
 
+// Which redundant epsilon paths compose() should leave out.
+// Without a filter, a run of epsilons on the left and one on the right
+// can be interleaved in every possible order.
+// SequenceFilter only takes the left epsilons first, and MatchFilter
+// also allows an epsilon on each side to be taken together, but then
+// only takes that pairing rather than the two separate steps.
+// Filters apply while neither side has anything in its backlog.
+enum ComposeFilter {
+  TrivialFilter  = 0,
+  SequenceFilter = 1,
+  MatchFilter    = 2
+};
+
+// Limits on the resources a composition may use, 0 meaning no limit.
+// When one is exceeded, composition stops with a ComposeLimitError.
+struct ComposeLimits {
+  size_t states = 0;
+  size_t arcs = 0;
+  // the most symbols waiting in the backlog of any one tape
+  size_t backlog = 0;
+  // peak resident memory of the process, in bytes
+  size_t memory = 0;
+};
+
+// How much a composition has used so far, together with where the
+// longest backlog was found: the input states it is waiting at and
+// the tape of the left (or right) transducer it is on.
+// When composition doesn't terminate it's almost always because some
+// backlog keeps growing, and this is the place to look.
+struct ComposeStats {
+  size_t states = 0;
+  size_t arcs = 0;
+  size_t backlog = 0;
+  size_t memory = 0;
+  state_t backlog_left_state = 0;
+  state_t backlog_right_state = 0;
+  bool backlog_right = false;
+  size_t backlog_tape = 0;
+};
+
+class ComposeLimitError : public std::runtime_error {
+public:
+  ComposeStats stats;
+  ComposeLimitError(const std::string& msg, const ComposeStats& stats_) :
+    std::runtime_error(msg), stats(stats_) {}
+};
+
+// How Composer matches the transitions leaving a pair of states:
+// by trying every pair (NestedLoopJoin), by sorting the right
+// transitions and looking up each left one (IndexedJoin), or by sorting
+// both and walking through them together (MergeJoin).
+// AutoJoin picks whichever looks cheapest for each state.
+enum ComposeJoin {
+  AutoJoin       = 0,
+  NestedLoopJoin = 1,
+  IndexedJoin    = 2,
+  MergeJoin      = 3
+};
+
+// Cheap statistics about one input of a composition.
+// Not gathered for lazy inputs (see TransducerView::isLazy()),
+// which are reported as empty, unsorted and nondeterministic.
+struct OperandStats {
+  size_t states = 0;
+  size_t arcs = 0;
+  size_t max_fanout = 0;
+  // for each tape, the fraction of transitions with epsilon on it
+  std::vector<double> epsilon_density;
+  // whether no state has two transitions with the same symbol
+  // on the composing tape, nor any epsilons there
+  bool deterministic = false;
+  // whether the transitions of every state are in order of their
+  // symbol on the composing tape
+  bool sorted = false;
+};
+
+// The statistics a Composer bases its choice of join on, and how many
+// states it has expanded with each join.
+struct ComposePlan {
+  OperandStats left;
+  OperandStats right;
+  ComposeJoin join = AutoJoin;
+  size_t nested = 0;
+  size_t indexed = 0;
+  size_t merged = 0;
+};
+
 struct ComposedState {
   state_t left_state;
   state_t right_state;
+  backlog_id left_backlog;
+  backlog_id right_backlog;
+  unsigned char filter_state;
+  flag_register_id flag_register;
   state_t out_state;
-  std::vector<std::deque<string_ref>> left_backlog;
-  std::vector<std::deque<string_ref>> right_backlog;
   //std::vector<BacklogDependency> deps; // this might not be the right data structure
 };
 
+// Identifies a ComposedState, with the backlogs given as their
+// ids in Composer::left_logs and Composer::right_logs
+struct ComposedStateKey {
+  state_t left_state;
+  state_t right_state;
+  backlog_id left_backlog;
+  backlog_id right_backlog;
+  unsigned char filter_state;
+  flag_register_id flag_register;
+  bool operator==(const ComposedStateKey& other) const {
+    return (left_state == other.left_state &&
+            right_state == other.right_state &&
+            left_backlog == other.left_backlog &&
+            right_backlog == other.right_backlog &&
+            filter_state == other.filter_state &&
+            flag_register == other.flag_register);
+  }
+};
+
+template<>
+struct std::hash<ComposedStateKey> {
+  size_t operator()(const ComposedStateKey& k) const;
+};
+
+// Where each state of a composition came from, so that it can be
+// updated by Composer::recompose() rather than built again from scratch.
+// states[s] is the state of the search which became output state s, and
+// its backlog ids index left_backlogs and right_backlogs, whose symbols
+// are from the alphabet of the output, and its flag_register indexes
+// flag_registers.
+struct ComposeProvenance {
+  std::vector<ComposedState> states;
+  std::vector<Backlog> left_backlogs;
+  std::vector<Backlog> right_backlogs;
+  std::vector<std::vector<int>> flag_registers;
+};
+
+// Working space for expanding a single ComposedState.
+// Each thread composing in parallel has its own.
+struct ComposeScratch {
+  // working copies of the backlogs of the state being extended
+  Backlog left_backlog;
+  Backlog right_backlog;
+  std::vector<std::pair<state_t, TransitionView>> right_trans;
+  // right transitions which are epsilon on the composing tapes
+  // (only filled in when a ComposeFilter is in effect)
+  std::vector<std::pair<state_t, TransitionView>> right_eps;
+
+  // The right transitions of the current state, sorted by their symbol
+  // on Composer::matchTape so that each left transition is only paired
+  // with the ones it could match. Transitions which might match anything
+  // (epsilons and set symbols) are listed in right_wild instead.
+  std::vector<std::pair<string_ref, size_t>> right_index;
+  std::vector<size_t> right_wild;
+  std::vector<size_t> candidates;
+  // For MergeJoin, the symbol on the composing tape of each left
+  // transition, and where its matches start in right_index.
+  std::vector<string_ref> left_syms;
+  std::vector<std::pair<string_ref, size_t>> left_index;
+  std::vector<size_t> left_match;
+  // for removing transitions which only differed on dropped tapes
+  std::vector<std::pair<size_t, size_t>> arc_hashes;
+  std::vector<bool> duplicate;
+  std::vector<int> flag_values;
+
+  // The result of Composer::expandState(): whether the state is final
+  // and its outgoing transitions (in the order they should be added)
+  // together with the states they lead to. out_state is not set.
+  bool final;
+  std::vector<std::pair<ComposedState, Transition>> arcs;
+};
+
+struct ParallelCompose;
+
 class Composer {
 private:
-  Transducer* a;
-  Transducer* b;
+  const TransducerView* a;
+  const TransducerView* b;
   Transducer* t;
-  std::map<string_ref, string_ref> left_update;
-  std::map<string_ref, string_ref> right_update;
+  // the id in t of each symbol of a or b, or empty if they are the same
+  std::vector<string_ref> left_update;
+  std::vector<string_ref> right_update;
   std::vector<size_t> placement;
   bool flagsAsEpsilon;
+  ComposeFilter filter;
+  SymbolMatcher matcher;
+  bool leftIdentities;
+  bool rightIdentities;
   size_t tapeCount;
+  size_t matchTape;
   std::deque<ComposedState> todo_list;
-  std::map<state_t, std::map<state_t, std::vector<ComposedState>>> done_list;
+  BacklogStore left_logs;
+  BacklogStore right_logs;
+  // only set if flags are being evaluated
+  FlagTable flag_table;
+  std::unique_ptr<FlagRegisterStore> flag_registers;
+  std::unordered_map<ComposedStateKey, state_t> done_list;
   Transition left_epsilon;
   Transition right_epsilon;
+  // the tapes of the composition which are kept (all of them if empty)
+  std::vector<size_t> keep;
+  // identity symbols which have to be renumbered once tapes are dropped,
+  // or mapped to epsilon if the tape they refer to is dropped
+  std::map<string_ref, string_ref> keep_update;
+  bool merged;
+  ComposeJoin join;
+  OperandStats left_stats;
+  OperandStats right_stats;
+  std::atomic<size_t> join_counts[4];
+  ComposeLimits limits;
+  std::atomic<size_t> state_count;
+  std::atomic<size_t> arc_count;
+  std::atomic<size_t> longest_backlog;
+  std::mutex stats_lock;
+  ComposeStats stats;
+
+  // The per-tape loops are instantiated for each combination of
+  // left and right tape counts (see utils/tape_count.h) and the
+  // constructor picks the versions matching a and b.
+  typedef bool (Composer::*EpsilonCheck)(const TransitionView& tr) const;
+  typedef bool (Composer::*TransitionComposer)(ComposeScratch& w, const TransitionView& a, const TransitionView& b, Transition* out) const;
+  EpsilonCheck isLeftEpsilonFn;
+  EpsilonCheck isRightEpsilonFn;
+  TransitionComposer composeTransitionFn;
+
+  template<typename L, typename R> bool isLeftEpsilonT(const TransitionView& tr) const;
+  template<typename L, typename R> bool isRightEpsilonT(const TransitionView& tr) const;
+  template<typename L, typename R> bool composeTransitionT(ComposeScratch& w, const TransitionView& a, const TransitionView& b, Transition* out) const;
+
+  bool isLeftEpsilon(const TransitionView& tr) const { return (this->*isLeftEpsilonFn)(tr); }
+  bool isRightEpsilon(const TransitionView& tr) const { return (this->*isRightEpsilonFn)(tr); }
+  bool backlogsOverlap(const ComposedState& s) const;
+  ComposedStateKey makeKey(const ComposedState& s) const;
+  OperandStats gatherStats(const TransducerView* t, size_t tape) const;
+  ComposeJoin chooseJoin(size_t left_fanout, size_t right_fanout) const;
+  // Apply the flag diacritics of tr to the register of next,
+  // returning false if they block the path.
+  bool applyFlags(ComposeScratch& w, const Transition& tr, ComposedState& next) const;
+  void project(Transition& tr) const;
+  void removeDuplicateArcs(ComposeScratch& w) const;
+  void indexRightTransitions(ComposeScratch& w) const;
+  void mergeLeftTransitions(ComposeScratch& w, const ComposedState& cur) const;
+  // Fill in w.candidates from the entries of w.right_index matching sym,
+  // starting at first.
+  void matchCandidates(ComposeScratch& w, string_ref sym, size_t first) const;
+
+  // Steps both working backlogs by a and b.
+  bool composeTransition(ComposeScratch& w, const TransitionView& a, const TransitionView& b, Transition* out) const {
+    return (this->*composeTransitionFn)(w, a, b, out);
+  }
+  bool processTransitionPair(ComposeScratch& w, const ComposedState& state, const TransitionView& left, const TransitionView& right, state_t lstate, state_t rstate, unsigned char filter_state = 0);
+  // The filter state after stepping only the left (or right) side by
+  // an epsilon, or -1 if the filter doesn't allow it.
+  int leftEpsilonFilter(unsigned char fs, bool right_has_eps) const;
+  int rightEpsilonFilter(unsigned char fs, bool left_has_eps) const;
+  void expandState(ComposeScratch& w, const ComposedState& cur);
+  ComposedState initialState() const;
+  void noteBacklog(const ComposedState& s, size_t length, bool right, size_t tape);
+  // throw a ComposeLimitError (stats_lock must be held)
+  [[noreturn]] void limitExceeded(const std::string& what);
+  // Called after each state is expanded, with the number of states so far.
+  void checkLimits(size_t states);
 
-  bool isLeftEpsilon(Transition& tr);
-  bool isRightEpsilon(Transition& tr);
-  bool backlogsOverlap(const ComposedState& s);
+  // expand everything in todo_list and whatever that leads to
+  void expandAll(ComposeScratch& w);
+  Transducer* composeSerial();
+  Transducer* composeParallel(size_t threads);
+  void composeWorker(ParallelCompose& p, size_t self);
 
-  bool composeTransition(Transition& a, Transition& b, ComposedState* state, Transition* out);
-  bool processTransitionPair(ComposedState& state, Transition& left, Transition& right, state_t lstate, state_t rstate);
+  friend class LazyComposition;
 public:
-  Composer(Transducer* a, Transducer* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon = true);
+  Composer(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter);
   ~Composer();
-  Transducer* compose();
+  void setLimits(const ComposeLimits& limits);
+  void setJoin(ComposeJoin join);
+  // Only keep these tapes (given by name, in any order) in the result.
+  // Transitions which become identical are only added once, and
+  // compose() and composePruned() finish by merging the states which
+  // become equivalent (see Transducer::mergeEquivalentStates()).
+  // Must be called before composing.
+  void keepTapes(const std::vector<UnicodeString>& names);
+  // Keep track of the values of the flag diacritic features along each
+  // path, so that paths which the flags make impossible are left out.
+  // The composed states include these values, so there may be more of
+  // them, though paths are only removed (the output keeps the flags).
+  // Must be called before composing.
+  void evaluateFlags();
+  ComposePlan getPlan() const;
+  ComposeStats getStats();
+  // With threads > 1, states are expanded in parallel and the result
+  // renumbered afterwards, so the output is the same for any thread count.
+  Transducer* compose(size_t threads = 1);
+  // Only keep paths whose weight is at most threshold more than the
+  // lightest path. States are expanded in order of their weight so far
+  // plus the distance to a final state in each input, so states which
+  // cannot lie on such a path are never expanded.
+  // Weights must be non-negative.
+  Transducer* composePruned(double threshold);
+  // Compose serially and write the result to out in the format of
+  // writeBin() without ever holding all of it in memory: the output
+  // transitions and the queue of states to expand go to temporary files
+  // in spillDir, and of the table of states found so far only the last
+  // memoryStates are kept in memory, the rest in sorted runs on disk.
+  // The output is the same as writeBin(compose()), and nothing is
+  // written to out until the composition is complete.
+  void composeToFile(FILE* out, const std::string& spillDir, size_t memoryStates = 1 << 22);
+  // The provenance of the result of compose() with a single thread
+  // or of recompose(), as long as no states were merged.
+  void getProvenance(ComposeProvenance& provenance) const;
+  // Update previous, the composition of an earlier version of the left
+  // transducer with the same right transducer, to the composition of the
+  // current left transducer, given previous's provenance and the states
+  // of the left transducer whose transitions or finality have changed
+  // (states added since need not be listed).
+  // Only output states coming from a changed left state, and states
+  // which are new, are expanded; the rest are copied from previous and
+  // keep their numbers. States which can no longer be reached are kept
+  // as well, so trim() the result if they are not wanted.
+  Transducer* recompose(const TransducerView* previous, const ComposeProvenance& provenance, const std::set<state_t>& changed);
 };
 
-Transducer* compose(Transducer* a, Transducer* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon = true);
+Transducer* compose(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter, size_t threads = 1, const ComposeLimits& limits = ComposeLimits());
+
+void composeToFile(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, FILE* out, const std::string& spillDir, size_t memoryStates = 1 << 22, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter, const ComposeLimits& limits = ComposeLimits());
+
+Transducer* composeWithProvenance(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, ComposeProvenance& provenance, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter);
+
+// see Composer::recompose(); provenance is updated to match the result
+Transducer* recompose(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, const TransducerView* previous, ComposeProvenance& provenance, const std::set<state_t>& changed, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter);
+
+Transducer* composePruned(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, double threshold, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter, const ComposeLimits& limits = ComposeLimits());
 
 #endif
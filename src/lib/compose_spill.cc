@@ -0,0 +1,260 @@
+#include "compose_spill.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+#include <unistd.h>
+
+bool
+operator<(const ComposedStateKey& a, const ComposedStateKey& b)
+{
+  return (std::tie(a.left_state, a.right_state, a.left_backlog, a.right_backlog, a.filter_state, a.flag_register) <
+          std::tie(b.left_state, b.right_state, b.left_backlog, b.right_backlog, b.filter_state, b.flag_register));
+}
+
+SpillFile::SpillFile(const std::string& dir) :
+  length(0)
+{
+  std::string name = dir + "/fsnt-spill-XXXXXX";
+  std::vector<char> buf(name.begin(), name.end());
+  buf.push_back('\0');
+  int fd = mkstemp(buf.data());
+  if(fd == -1) {
+    throw std::runtime_error("Cannot create temporary file in '" + dir + "': " + strerror(errno));
+  }
+  unlink(buf.data());
+  file = fdopen(fd, "w+b");
+  if(file == NULL) {
+    close(fd);
+    throw std::runtime_error(std::string("Cannot open temporary file: ") + strerror(errno));
+  }
+}
+
+SpillFile::~SpillFile()
+{
+  fclose(file);
+}
+
+void
+SpillFile::append(const void* data, size_t bytes)
+{
+  fseek(file, 0, SEEK_END);
+  if(fwrite(data, 1, bytes, file) != bytes) {
+    throw std::runtime_error(std::string("Cannot write temporary file: ") + strerror(errno));
+  }
+  length += bytes;
+}
+
+void
+SpillFile::read(size_t offset, void* data, size_t bytes)
+{
+  fseek(file, (long)offset, SEEK_SET);
+  if(fread(data, 1, bytes, file) != bytes) {
+    throw std::runtime_error("Cannot read temporary file");
+  }
+}
+
+void
+SpillFile::copyTo(FILE* out)
+{
+  fflush(file);
+  fseek(file, 0, SEEK_SET);
+  char buf[65536];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+    if(fwrite(buf, 1, n, out) != n) {
+      throw std::runtime_error(std::string("Cannot write output: ") + strerror(errno));
+    }
+  }
+}
+
+SpilledStateTable::SpilledStateTable(const std::string& dir_, size_t limit_) :
+  dir(dir_),
+  limit(std::max(limit_, (size_t)1))
+{
+}
+
+SpilledStateTable::~SpilledStateTable()
+{
+  for(auto& run : runs) {
+    delete run.file;
+  }
+}
+
+void
+SpilledStateTable::writeRun(std::vector<SpilledStateEntry>& entries)
+{
+  std::sort(entries.begin(), entries.end(),
+            [](const SpilledStateEntry& a, const SpilledStateEntry& b) {
+              return a.key < b.key;
+            });
+  Run run;
+  run.file = new SpillFile(dir);
+  run.count = entries.size();
+  for(size_t i = 0; i < entries.size(); i += FENCE) {
+    run.fences.push_back(entries[i].key);
+  }
+  run.file->append(entries.data(), entries.size() * sizeof(SpilledStateEntry));
+  runs.push_back(run);
+  if(runs.size() >= MAX_RUNS) {
+    mergeRuns();
+  }
+}
+
+void
+SpilledStateTable::mergeRuns()
+{
+  // each run is read a block at a time
+  struct Cursor {
+    size_t next;
+    std::vector<SpilledStateEntry> buf;
+    size_t pos;
+  };
+  std::vector<Cursor> cursors(runs.size());
+  auto refill = [&](size_t r) {
+    Cursor& c = cursors[r];
+    size_t n = std::min(FENCE, runs[r].count - c.next);
+    c.buf.resize(n);
+    c.pos = 0;
+    runs[r].file->read(c.next * sizeof(SpilledStateEntry), c.buf.data(), n * sizeof(SpilledStateEntry));
+    c.next += n;
+    return n > 0;
+  };
+  auto later = [&](size_t x, size_t y) {
+    return cursors[y].buf[cursors[y].pos].key < cursors[x].buf[cursors[x].pos].key;
+  };
+  std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+  for(size_t r = 0; r < runs.size(); r++) {
+    cursors[r].next = 0;
+    if(refill(r)) {
+      heads.push(r);
+    }
+  }
+
+  Run merged;
+  merged.file = new SpillFile(dir);
+  merged.count = 0;
+  std::vector<SpilledStateEntry> out;
+  while(!heads.empty()) {
+    size_t r = heads.top();
+    heads.pop();
+    Cursor& c = cursors[r];
+    if(merged.count % FENCE == 0) {
+      merged.fences.push_back(c.buf[c.pos].key);
+    }
+    out.push_back(c.buf[c.pos]);
+    merged.count++;
+    if(out.size() == FENCE) {
+      merged.file->append(out.data(), out.size() * sizeof(SpilledStateEntry));
+      out.clear();
+    }
+    c.pos++;
+    if(c.pos < c.buf.size() || refill(r)) {
+      heads.push(r);
+    }
+  }
+  merged.file->append(out.data(), out.size() * sizeof(SpilledStateEntry));
+
+  for(auto& run : runs) {
+    delete run.file;
+  }
+  runs.clear();
+  runs.push_back(merged);
+}
+
+bool
+SpilledStateTable::findInRun(Run& run, const ComposedStateKey& key, state_t& id)
+{
+  auto fence = std::upper_bound(run.fences.begin(), run.fences.end(), key);
+  if(fence == run.fences.begin()) {
+    return false;
+  }
+  size_t start = (size_t)(fence - run.fences.begin() - 1) * FENCE;
+  size_t n = std::min(FENCE, run.count - start);
+  block.resize(n);
+  run.file->read(start * sizeof(SpilledStateEntry), block.data(), n * sizeof(SpilledStateEntry));
+  auto loc = std::lower_bound(block.begin(), block.end(), key,
+                              [](const SpilledStateEntry& e, const ComposedStateKey& k) {
+                                return e.key < k;
+                              });
+  if(loc != block.end() && loc->key == key) {
+    id = loc->id;
+    return true;
+  }
+  return false;
+}
+
+bool
+SpilledStateTable::find(const ComposedStateKey& key, state_t& id)
+{
+  auto loc = recent.find(key);
+  if(loc != recent.end()) {
+    id = loc->second;
+    return true;
+  }
+  for(auto run = runs.rbegin(); run != runs.rend(); ++run) {
+    if(findInRun(*run, key, id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+SpilledStateTable::insert(const ComposedStateKey& key, state_t id)
+{
+  recent[key] = id;
+  if(recent.size() >= limit) {
+    std::vector<SpilledStateEntry> entries;
+    entries.reserve(recent.size());
+    for(auto& it : recent) {
+      entries.push_back({it.first, it.second});
+    }
+    recent.clear();
+    writeRun(entries);
+  }
+}
+
+SpilledStateQueue::SpilledStateQueue(const std::string& dir) :
+  file(dir),
+  read_offset(0),
+  head_pos(0)
+{
+}
+
+bool
+SpilledStateQueue::empty() const
+{
+  return head_pos == head.size() && read_offset == file.size() && tail.empty();
+}
+
+void
+SpilledStateQueue::push(const ComposedState& s)
+{
+  tail.push_back(s);
+  if(tail.size() == BLOCK) {
+    file.append(tail.data(), tail.size() * sizeof(ComposedState));
+    tail.clear();
+  }
+}
+
+ComposedState
+SpilledStateQueue::pop()
+{
+  if(head_pos == head.size()) {
+    head_pos = 0;
+    if(read_offset < file.size()) {
+      // everything in the file was pushed before anything in tail
+      size_t n = std::min(BLOCK, (file.size() - read_offset) / sizeof(ComposedState));
+      head.resize(n);
+      file.read(read_offset, head.data(), n * sizeof(ComposedState));
+      read_offset += n * sizeof(ComposedState);
+    } else {
+      head.swap(tail);
+      tail.clear();
+    }
+  }
+  return head[head_pos++];
+}
@@ -0,0 +1,93 @@
+#ifndef _LIB_COMPOSE_SPILL_H_
+#define _LIB_COMPOSE_SPILL_H_
+
+#include "compose.h"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An anonymous temporary file in a given directory.
+// It is unlinked as soon as it is created, so nothing is left
+// behind if the program dies.
+class SpillFile {
+private:
+  FILE* file;
+  size_t length;
+public:
+  SpillFile(const std::string& dir);
+  ~SpillFile();
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  FILE* handle() { return file; }
+  // the number of bytes written so far
+  size_t size() const { return length; }
+  void append(const void* data, size_t bytes);
+  // read bytes starting at offset, which must all have been written
+  void read(size_t offset, void* data, size_t bytes);
+  // copy the whole file to out
+  void copyTo(FILE* out);
+};
+
+struct SpilledStateEntry {
+  ComposedStateKey key;
+  state_t id;
+};
+
+// A map from ComposedStateKey to output state which only keeps the
+// most recently added states in memory.
+// Whenever the in-memory table reaches its limit it is written out as a
+// run sorted by key, together with every FENCE-th key so that looking up
+// a key only reads one block from one run. Once there are MAX_RUNS runs
+// they are merged into one.
+class SpilledStateTable {
+private:
+  struct Run {
+    SpillFile* file;
+    size_t count;
+    std::vector<ComposedStateKey> fences;
+  };
+  static constexpr size_t FENCE = 256;
+  static constexpr size_t MAX_RUNS = 8;
+
+  std::string dir;
+  size_t limit;
+  std::unordered_map<ComposedStateKey, state_t> recent;
+  std::vector<Run> runs;
+  std::vector<SpilledStateEntry> block;
+
+  void writeRun(std::vector<SpilledStateEntry>& entries);
+  void mergeRuns();
+  bool findInRun(Run& run, const ComposedStateKey& key, state_t& id);
+public:
+  SpilledStateTable(const std::string& dir, size_t limit);
+  ~SpilledStateTable();
+
+  bool find(const ComposedStateKey& key, state_t& id);
+  // key must not already be present
+  void insert(const ComposedStateKey& key, state_t id);
+};
+
+// A first-in first-out queue of ComposedStates which keeps at most
+// two blocks of them in memory and the rest in a SpillFile.
+class SpilledStateQueue {
+private:
+  static constexpr size_t BLOCK = 4096;
+
+  SpillFile file;
+  size_t read_offset;
+  std::vector<ComposedState> head;
+  size_t head_pos;
+  std::vector<ComposedState> tail;
+public:
+  SpilledStateQueue(const std::string& dir);
+
+  bool empty() const;
+  void push(const ComposedState& s);
+  ComposedState pop();
+};
+
+bool operator<(const ComposedStateKey& a, const ComposedStateKey& b);
+
+#endif
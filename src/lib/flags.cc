@@ -0,0 +1,130 @@
+#include "flags.h"
+#include "backlog_store.h"
+#include <algorithm>
+#include <mutex>
+
+bool
+applyFlag(const FlagSymbolStruct& flag, int& value)
+{
+  int val = (int)flag.val.i;
+  switch(flag.type) {
+    case Clear:
+      value = 0;
+      return true;
+    case Positive:
+      value = val;
+      return true;
+    case Negative:
+      value = -val;
+      return true;
+    case Require:
+      return (val == 0 ? value != 0 : value == val);
+    case Disallow:
+      if(val == 0) {
+        return value == 0;
+      }
+      return value != val;
+    case Unification:
+      if(value != 0 && value != val) {
+        return false;
+      }
+      value = val;
+      return true;
+    case None:
+      break;
+  }
+  return true;
+}
+
+FlagTable::FlagTable()
+{
+}
+
+FlagTable::FlagTable(const SymbolTable& alpha)
+{
+  for(auto& it : alpha.getDefined()) {
+    if(it.second.type != FlagSymbol) {
+      continue;
+    }
+    auto loc = features.try_emplace(it.second.flag.sym, features.size());
+    if(feature_of.size() <= it.first.i) {
+      feature_of.resize(it.first.i + 1, -1);
+    }
+    feature_of[it.first.i] = (int)loc.first->second;
+    flags[it.first] = it.second.flag;
+  }
+}
+
+size_t
+hashRegister(const std::vector<int>& values)
+{
+  size_t ret = values.size();
+  for(auto val : values) {
+    ret = hashCombine(ret, (size_t)(unsigned int)val);
+  }
+  return ret;
+}
+
+FlagRegisterStore::FlagRegisterStore(size_t features_) :
+  features(features_)
+{
+  data.resize(features, 0);
+}
+
+bool
+FlagRegisterStore::find(size_t hash, const std::vector<int>& values, flag_register_id& id) const
+{
+  auto range = index.equal_range(hash);
+  for(auto it = range.first; it != range.second; ++it) {
+    if(std::equal(values.begin(), values.end(), data.begin() + (long)(it->second * features))) {
+      id = it->second;
+      return true;
+    }
+  }
+  return false;
+}
+
+flag_register_id
+FlagRegisterStore::intern(const std::vector<int>& values)
+{
+  if(std::all_of(values.begin(), values.end(), [](int v) { return v == 0; })) {
+    return UNSET;
+  }
+  size_t hash = hashRegister(values);
+  flag_register_id id;
+  {
+    std::shared_lock<std::shared_mutex> read(lock);
+    if(find(hash, values, id)) {
+      return id;
+    }
+  }
+  std::unique_lock<std::shared_mutex> write(lock);
+  if(find(hash, values, id)) {
+    return id;
+  }
+  id = (flag_register_id)(data.size() / features);
+  data.insert(data.end(), values.begin(), values.end());
+  index.insert(std::make_pair(hash, id));
+  return id;
+}
+
+void
+FlagRegisterStore::load(flag_register_id id, std::vector<int>& values) const
+{
+  values.assign(features, 0);
+  if(id == UNSET) {
+    return;
+  }
+  std::shared_lock<std::shared_mutex> read(lock);
+  std::copy(data.begin() + (long)(id * features), data.begin() + (long)((id + 1) * features), values.begin());
+}
+
+size_t
+FlagRegisterStore::size() const
+{
+  if(features == 0) {
+    return 1;
+  }
+  std::shared_lock<std::shared_mutex> read(lock);
+  return data.size() / features;
+}
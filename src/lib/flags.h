@@ -0,0 +1,55 @@
+#ifndef _LIB_FLAGS_H_
+#define _LIB_FLAGS_H_
+
+#include "symbol_table.h"
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Along a path, each flag diacritic feature is 0 while it is unset,
+// v after @P.f.v@ and -v after @N.f.v@ (v being the symbol id of the value).
+// Applies flag to the value of its feature, returning false if the path
+// is blocked there.
+bool applyFlag(const FlagSymbolStruct& flag, int& value);
+
+// The flag symbols of an alphabet, with their features numbered densely.
+class FlagTable {
+private:
+  std::vector<int> feature_of;  // by symbol id, -1 if not a flag
+  std::map<string_ref, size_t> features;
+  std::map<string_ref, FlagSymbolStruct> flags;
+public:
+  FlagTable();
+  FlagTable(const SymbolTable& alpha);
+  size_t featureCount() const { return features.size(); }
+  bool isFlag(string_ref sym) const {
+    return sym.i < feature_of.size() && feature_of[sym.i] != -1;
+  }
+  size_t feature(string_ref sym) const { return (size_t)feature_of[sym.i]; }
+  const FlagSymbolStruct& flag(string_ref sym) const { return flags.at(sym); }
+};
+
+typedef uint32_t flag_register_id;
+
+// Hash-consed store of the values of every feature at once, like
+// BacklogStore. Id 0 is always the register with every feature unset.
+// All methods may be called from several threads at once.
+class FlagRegisterStore {
+private:
+  size_t features;
+  std::vector<int> data;
+  std::unordered_multimap<size_t, flag_register_id> index;
+  mutable std::shared_mutex lock;
+
+  bool find(size_t hash, const std::vector<int>& values, flag_register_id& id) const;
+public:
+  static constexpr flag_register_id UNSET = 0;
+  FlagRegisterStore(size_t features);
+  flag_register_id intern(const std::vector<int>& values);
+  void load(flag_register_id id, std::vector<int>& values) const;
+  size_t size() const;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "frozen_transducer.h"
+
+FrozenTransducer::FrozenTransducer(size_t tapes) :
+  tapeCount(tapes),
+  alphabet(std::make_shared<SymbolTable>()),
+  alphabetShared(false)
+{
+  offsets.push_back(0);
+}
+
+FrozenTransducer::FrozenTransducer(const TransducerView* t) :
+  tapeCount(t->getTapeCount()),
+  alphabet(t->getSharedAlphabet()),
+  alphabetShared(alphabet != nullptr),
+  finals(t->getFinals()),
+  tapeNames(t->getTapeInfo())
+{
+  if(!alphabet) {
+    alphabet = std::make_shared<SymbolTable>(t->getAlphabet());
+  }
+  offsets.reserve(t->size() + 1);
+  offsets.push_back(0);
+  for(state_t state = 0; state < t->size(); state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      TransitionView tr = it.transition();
+      arcs.push_back({it.target(), tr.weight});
+      symbols.insert(symbols.end(), tr.symbols.begin(), tr.symbols.end());
+    }
+    offsets.push_back(arcs.size());
+  }
+}
+
+FrozenTransducer::~FrozenTransducer()
+{
+}
+
+const SymbolTable&
+FrozenTransducer::getAlphabet() const
+{
+  return *alphabet;
+}
+
+std::shared_ptr<SymbolTable>
+FrozenTransducer::getSharedAlphabet() const
+{
+  return (alphabetShared ? alphabet : nullptr);
+}
+
+const std::map<state_t, double>&
+FrozenTransducer::getFinals() const
+{
+  return finals;
+}
+
+const std::map<UnicodeString, TapeInfo>&
+FrozenTransducer::getTapeInfo() const
+{
+  return tapeNames;
+}
+
+size_t
+FrozenTransducer::getTapeCount() const
+{
+  return tapeCount;
+}
+
+size_t
+FrozenTransducer::size() const
+{
+  return offsets.size() - 1;
+}
+
+size_t
+FrozenTransducer::arcCount() const
+{
+  return arcs.size();
+}
+
+bool
+FrozenTransducer::isFinal(state_t state) const
+{
+  return finals.find(state) != finals.end();
+}
+
+TransitionIterator
+FrozenTransducer::iterState(state_t state) const
+{
+  return TransitionIterator(this, arcsBegin(state), arcsEnd(state));
+}
+
+void
+FrozenTransducer::relabel(const std::vector<string_ref>& update, const SymbolTable& alpha)
+{
+  for(auto& sym : symbols) {
+    sym = update[sym.i];
+  }
+  alphabet = std::make_shared<SymbolTable>(alpha);
+  alphabetShared = false;
+}
+
+void
+unifyAlphabets(const std::vector<FrozenTransducer*>& ts)
+{
+  bool shared = !ts.empty() && ts[0]->getSharedAlphabet();
+  for(auto t : ts) {
+    shared = shared && t->getSharedAlphabet() == ts[0]->getSharedAlphabet();
+  }
+  if(shared) {
+    return;
+  }
+  SymbolTable alpha;
+  std::vector<std::vector<string_ref>> updates;
+  for(auto t : ts) {
+    updates.push_back(alpha.merge(t->getAlphabet()));
+  }
+  for(size_t i = 0; i < ts.size(); i++) {
+    ts[i]->relabel(updates[i], alpha);
+  }
+}
+
+Transition
+FrozenTransducer::transition(size_t idx) const
+{
+  Transition tr;
+  const string_ref* syms = arcSymbols(idx);
+  tr.symbols.assign(syms, syms + tapeCount);
+  tr.weight = arcs[idx].weight;
+  return tr;
+}
@@ -0,0 +1,65 @@
+#ifndef _LIB_FROZEN_TRANSDUCER_H_
+#define _LIB_FROZEN_TRANSDUCER_H_
+
+#include "transducer.h"
+
+#include <cstdio>
+#include <map>
+#include <vector>
+
+struct FrozenArc {
+  state_t target;
+  double weight;
+};
+
+// Immutable compressed-sparse-row version of a Transducer.
+// The arcs leaving state s are arcs[offsets[s]] to arcs[offsets[s+1]-1],
+// ordered by target and then by insertion order (the same order in which
+// Transducer stores them), and the tape symbols of arc i are
+// symbols[i*tapeCount] to symbols[(i+1)*tapeCount-1].
+class FrozenTransducer : public TransducerView {
+private:
+  size_t tapeCount;
+  std::shared_ptr<SymbolTable> alphabet;
+  bool alphabetShared;
+  std::vector<size_t> offsets;
+  std::vector<FrozenArc> arcs;
+  std::vector<string_ref> symbols;
+  std::map<state_t, double> finals;
+  std::map<UnicodeString, TapeInfo> tapeNames;
+
+  FrozenTransducer(size_t tapes);
+  friend FrozenTransducer* readFrozenBin(FILE* in);
+public:
+  FrozenTransducer(const TransducerView* t);
+  ~FrozenTransducer();
+
+  const SymbolTable& getAlphabet() const override;
+  std::shared_ptr<SymbolTable> getSharedAlphabet() const override;
+  const std::map<state_t, double>& getFinals() const override;
+  const std::map<UnicodeString, TapeInfo>& getTapeInfo() const override;
+  size_t getTapeCount() const override;
+  size_t size() const override;
+  bool isFinal(state_t state) const override;
+  TransitionIterator iterState(state_t state) const override;
+  size_t arcCount() const;
+
+  size_t arcsBegin(state_t state) const { return offsets[state]; }
+  size_t arcsEnd(state_t state) const { return offsets[state+1]; }
+  const FrozenArc& arc(size_t idx) const { return arcs[idx]; }
+  const string_ref* arcSymbols(size_t idx) const {
+    return symbols.data() + idx * tapeCount;
+  }
+  Transition transition(size_t idx) const;
+
+  // Replace each symbol s by update[s] in one pass over the arcs and
+  // use alpha as the alphabet, as given by alpha.merge(getAlphabet()).
+  void relabel(const std::vector<string_ref>& update, const SymbolTable& alpha);
+};
+
+// Relabel all of ts to use the same alphabet, so that composing them
+// doesn't need to translate symbols. Nothing is done if they already
+// share one.
+void unifyAlphabets(const std::vector<FrozenTransducer*>& ts);
+
+#endif
@@ -1,6 +1,8 @@
 #include "io.h"
+#include "reorder_symbols.h"
 #include "utils/icu-iter.h"
 #include "utils/compression.h"
+#include "utils/tape_count.h"
 #include <vector>
 #include <unicode/unistr.h>
 #include <unicode/uchar.h>
@@ -9,13 +11,9 @@
 
 #include <iostream>
 
-Transducer*
-readBin(FILE* in)
+size_t
+readBinHeader(FILE* in, bool* read_weights, bool* shared_alphabet)
 {
-  ////////// HEADER
-
-  bool read_weights = false;
-
   char header[4]{};
   size_t bytes_read = fread(header, 1, 4, in);
   if (bytes_read == 4 && strncmp(header, HEADER_TRANSDUCER, 4) == 0) {
@@ -23,41 +21,63 @@ readBin(FILE* in)
     if (features >= TDF_UNKNOWN) {
       throw std::runtime_error("Transducer has features that are unknown to this version of fsnt - upgrade!");
     }
-    read_weights = (features & TDF_WEIGHTS);
+    *read_weights = (features & TDF_WEIGHTS);
+    *shared_alphabet = (features & TDF_SHARED_ALPHABET);
   } else {
     throw std::runtime_error("Missing transducer header");
   }
 
-  size_t tapes = Compression::multibyte_read(in);
-
-  Transducer* t = new Transducer(tapes);
+  return Compression::multibyte_read(in);
+}
 
+std::map<UnicodeString, TapeInfo>
+readBinTapeInfo(FILE* in)
+{
+  std::map<UnicodeString, TapeInfo> ret;
   size_t tape_name_count = Compression::multibyte_read(in);
   for(size_t i = 0; i < tape_name_count; i++) {
     UnicodeString name = Compression::string_read(in);
     TapeInfo info;
     info.index = Compression::multibyte_read(in);
     info.flags = Compression::multibyte_read(in);
-    t->setTapeInfo(name, info);
+    ret[name] = info;
   }
+  return ret;
+}
 
-  ////////// ALPHABET
-
-  t->getAlphabet().read(in);
-
-  ////////// FINALS
-
+void
+readBinFinals(FILE* in, bool read_weights, std::map<state_t, double>& finals)
+{
   for(unsigned int i = 0, lim = Compression::multibyte_read(in); i < lim; i++) {
     state_t state = Compression::multibyte_read(in);
-    t->setFinal(state, (read_weights ? Compression::long_multibyte_read(in) : 0.000));
+    finals[state] = (read_weights ? Compression::long_multibyte_read(in) : 0.000);
   }
+}
 
-  ////////// TRANSITIONS
+template<typename Tapes>
+void
+readBinSymbols(FILE* in, size_t tapes, string_ref* syms)
+{
+  for(size_t s = 0; s < Tapes::count(tapes); s++) {
+    syms[s] = string_ref(Compression::multibyte_read(in));
+  }
+}
 
-  unsigned int state_count = Compression::multibyte_read(in);
-  t->addStates(state_count - 1);
+template<typename Tapes>
+void
+writeBinSymbols(const string_ref* syms, size_t tapes, FILE* out)
+{
+  for(size_t s = 0; s < Tapes::count(tapes); s++) {
+    Compression::multibyte_write((unsigned int)syms[s], out);
+  }
+}
 
-  for(unsigned int src = 0; src < state_count; src++) {
+template<typename Tapes>
+void
+readBinTransitions(FILE* in, bool read_weights, Transducer* t)
+{
+  size_t tapes = t->getTapeCount();
+  for(state_t src = 0; src < t->size(); src++) {
     for(unsigned int i = 0, lim = Compression::multibyte_read(in); i < lim; i++) {
       unsigned int dest = Compression::multibyte_read(in);
       unsigned int tr_count = Compression::multibyte_read(in);
@@ -65,38 +85,143 @@ readBin(FILE* in)
       {
         Transition tr;
         tr.symbols.resize(tapes);
-        for(unsigned int s = 0; s < tapes; s++) {
-          tr.symbols[s] = string_ref(Compression::multibyte_read(in));
-        }
+        readBinSymbols<Tapes>(in, tapes, tr.symbols.data());
         tr.weight = (read_weights ? Compression::long_multibyte_read(in) : 0.000);
         t->insertTransition(src, dest, tr);
       }
     }
   }
+}
+
+Transducer*
+readBin(FILE* in)
+{
+  ////////// HEADER
+
+  bool read_weights = false;
+  bool shared_alphabet = false;
+  size_t tapes = readBinHeader(in, &read_weights, &shared_alphabet);
+
+  Transducer* t = new Transducer(tapes);
+
+  t->setTapeInfo(readBinTapeInfo(in));
+
+  ////////// ALPHABET
+
+  t->getAlphabet().read(in);
+  if(shared_alphabet) {
+    std::shared_ptr<SymbolTable> shared = sharedAlphabet(t->getAlphabet());
+    if(shared) {
+      t->shareAlphabet(shared);
+    }
+  }
+
+  ////////// FINALS
+
+  readBinFinals(in, read_weights, t->getFinals());
+
+  ////////// TRANSITIONS
+
+  unsigned int state_count = Compression::multibyte_read(in);
+  t->addStates(state_count - 1);
+
+  dispatchTapes(tapes, [&](auto count) {
+    readBinTransitions<decltype(count)>(in, read_weights, t);
+  });
+
+  return t;
+}
+
+FrozenTransducer*
+readFrozenBin(FILE* in)
+{
+  ////////// HEADER
+
+  bool read_weights = false;
+  bool shared_alphabet = false;
+  size_t tapes = readBinHeader(in, &read_weights, &shared_alphabet);
+
+  FrozenTransducer* t = new FrozenTransducer(tapes);
+
+  for(auto& it : readBinTapeInfo(in)) {
+    if(it.second.index >= tapes) {
+      delete t;
+      throw std::invalid_argument("TapeInfo refers to non-existent index");
+    }
+    t->tapeNames[it.first] = it.second;
+  }
+
+  ////////// ALPHABET
+
+  t->alphabet->read(in);
+  if(shared_alphabet) {
+    std::shared_ptr<SymbolTable> shared = sharedAlphabet(*t->alphabet);
+    if(shared) {
+      t->alphabet = shared;
+      t->alphabetShared = true;
+    }
+  }
+
+  ////////// FINALS
+
+  readBinFinals(in, read_weights, t->finals);
+
+  ////////// TRANSITIONS
+
+  // the binary format stores each state's arcs grouped by target
+  // in ascending order, which is exactly the frozen layout,
+  // so arcs can be appended as they are read
+  unsigned int state_count = Compression::multibyte_read(in);
+  t->offsets.reserve(state_count + 1);
+
+  dispatchTapes(tapes, [&](auto count) {
+    for(unsigned int src = 0; src < state_count; src++) {
+      for(unsigned int i = 0, lim = Compression::multibyte_read(in); i < lim; i++) {
+        unsigned int dest = Compression::multibyte_read(in);
+        if(dest >= state_count) {
+          delete t;
+          throw std::invalid_argument("Transition refers to non-existent state");
+        }
+        unsigned int tr_count = Compression::multibyte_read(in);
+        for(unsigned int ti = 0; ti < tr_count; ti++)
+        {
+          t->symbols.resize(t->symbols.size() + tapes);
+          readBinSymbols<decltype(count)>(in, tapes, t->symbols.data() + t->symbols.size() - tapes);
+          double weight = (read_weights ? Compression::long_multibyte_read(in) : 0.000);
+          t->arcs.push_back({dest, weight});
+        }
+      }
+      t->offsets.push_back(t->arcs.size());
+    }
+  });
+  if(state_count == 0) {
+    t->offsets.push_back(0);
+  }
 
   return t;
 }
 
 void
-writeBin(Transducer* t, FILE *out)
+writeBinHeader(const TransducerView* t, bool write_weights, FILE* out)
 {
   ////////// HEADER
 
   fwrite(HEADER_TRANSDUCER, 1, 4, out);
 
-  bool write_weights = true; //weighted();
-
   uint64_t features = 0;
   if (write_weights) {
       features |= TDF_WEIGHTS;
   }
+  if (t->getSharedAlphabet()) {
+      features |= TDF_SHARED_ALPHABET;
+  }
   write_le(out, features);
 
   Compression::multibyte_write(t->getTapeCount(), out);
 
-  auto tapes = t->getTapeInfo();
+  const auto& tapes = t->getTapeInfo();
   Compression::multibyte_write(tapes.size(), out);
-  for(auto it : tapes) {
+  for(auto& it : tapes) {
     Compression::string_write(it.first, out);
     Compression::multibyte_write(it.second.index, out);
     Compression::multibyte_write(it.second.flags, out);
@@ -108,7 +233,7 @@ writeBin(Transducer* t, FILE *out)
 
   ////////// FINALS
 
-  auto finals = t->getFinals();
+  const auto& finals = t->getFinals();
   Compression::multibyte_write(finals.size(), out);
 
   for(auto& it : finals) {
@@ -117,21 +242,33 @@ writeBin(Transducer* t, FILE *out)
       Compression::long_multibyte_write(it.second, out);
     }
   }
+}
 
-  ////////// TRANSITIONS
-
-  auto transitions = t->getTransitions();
-  Compression::multibyte_write(transitions.size(), out);
-
-  for(auto& it : transitions) {
-    Compression::multibyte_write(it.size(), out);
-    for(auto& it2 : it) {
-      Compression::multibyte_write(it2.first, out);
-      Compression::multibyte_write(it2.second.size(), out);
-      for(auto& tr : it2.second) {
-        for(auto sym : tr.symbols) {
-          Compression::multibyte_write((unsigned int)sym, out);
-        }
+template<typename Tapes>
+void
+writeBinTransitions(const TransducerView* t, bool write_weights, FILE* out)
+{
+  Compression::multibyte_write(t->size(), out);
+
+  std::vector<std::pair<state_t, size_t>> groups;
+  for(state_t src = 0; src < t->size(); src++) {
+    // transitions are ordered by target, so each run of equal targets
+    // corresponds to one entry in the binary format
+    groups.clear();
+    for(auto it = t->iterState(src); it != it.end(); ++it) {
+      if(groups.empty() || groups.back().first != it.target()) {
+        groups.push_back(std::make_pair(it.target(), 0));
+      }
+      groups.back().second++;
+    }
+    Compression::multibyte_write(groups.size(), out);
+    auto it = t->iterState(src);
+    for(auto& group : groups) {
+      Compression::multibyte_write(group.first, out);
+      Compression::multibyte_write(group.second, out);
+      for(size_t i = 0; i < group.second; i++, ++it) {
+        TransitionView tr = it.transition();
+        writeBinSymbols<Tapes>(tr.symbols.data(), tr.symbols.size(), out);
         if(write_weights) {
           Compression::long_multibyte_write(tr.weight, out);
         }
@@ -140,8 +277,53 @@ writeBin(Transducer* t, FILE *out)
   }
 }
 
+void
+writeBinState(const std::vector<std::pair<state_t, Transition>>& arcs, FILE* out)
+{
+  size_t groups = 0;
+  for(size_t i = 0; i < arcs.size(); i++) {
+    if(i == 0 || arcs[i].first != arcs[i-1].first) {
+      groups++;
+    }
+  }
+  Compression::multibyte_write(groups, out);
+  for(size_t i = 0; i < arcs.size(); ) {
+    size_t end = i;
+    while(end < arcs.size() && arcs[end].first == arcs[i].first) {
+      end++;
+    }
+    Compression::multibyte_write(arcs[i].first, out);
+    Compression::multibyte_write(end - i, out);
+    for(; i < end; i++) {
+      const Transition& tr = arcs[i].second;
+      writeBinSymbols<DynamicTapes>(tr.symbols.data(), tr.symbols.size(), out);
+      Compression::long_multibyte_write(tr.weight, out);
+    }
+  }
+}
+
+void
+writeBin(const TransducerView* t, FILE *out, bool reorder)
+{
+  if(reorder && !t->getSharedAlphabet()) {
+    Transducer* sorted = reorderSymbols(t);
+    writeBin(sorted, out);
+    delete sorted;
+    return;
+  }
+  bool write_weights = true; //weighted();
+
+  writeBinHeader(t, write_weights, out);
+
+  ////////// TRANSITIONS
+
+  dispatchTapes(t->getTapeCount(), [&](auto count) {
+    writeBinTransitions<decltype(count)>(t, write_weights, out);
+  });
+}
+
 Transducer*
-readATT(UFILE* in)
+readATT(UFILE* in, std::shared_ptr<SymbolTable> alphabet)
 {
   vector<vector<UnicodeString>> headers;
   vector<vector<UnicodeString>> lines;
@@ -243,6 +425,9 @@ readATT(UFILE* in)
   size_t final_len = (weighted ? 2 : 1);
 
   Transducer* t = new Transducer(tapes);
+  if(alphabet) {
+    t->shareAlphabet(alphabet);
+  }
   SymbolTable& alpha = t->getAlphabet();
   for(auto line : lines) {
     if(line.size() == transition_len) {
@@ -282,13 +467,12 @@ readATT(UFILE* in)
 }
 
 void
-writeATT(Transducer* t, UFILE* out, bool writeWeights, bool writeHeaders)
+writeATT(const TransducerView* t, UFILE* out, bool writeWeights, bool writeHeaders)
 {
   if(writeHeaders) {
     vector<UnicodeString> names = vector<UnicodeString>(t->getTapeCount());
     map<UnicodeString, vector<UnicodeString>> altNames;
-    auto info = t->getTapeInfo();
-    for(auto it : info) {
+    for(auto& it : t->getTapeInfo()) {
       size_t idx = it.second.index;
       if(names[idx].length() == 0) {
         names[idx] = it.first;
@@ -309,22 +493,19 @@ writeATT(Transducer* t, UFILE* out, bool writeWeights, bool writeHeaders)
       }
     }
   }
-  auto transitions = t->getTransitions();
-  auto alphabet = t->getAlphabet();
-  for(unsigned int src = 0; src < transitions.size(); src++) {
-    for(auto& it : transitions[src]) {
-      unsigned int dest = it.first;
-      for(auto& tr : it.second) {
-        u_fprintf(out, "%d\t%d\t", src, dest);
-        for(auto& sym : tr.symbols) {
-          alphabet.write_symbol(out, sym, true);
-          u_fprintf(out, "\t");
-        }
-        if(writeWeights) {
-          u_fprintf(out, "%f", tr.weight);
-        }
-        u_fprintf(out, "\n");
+  const SymbolTable& alphabet = t->getAlphabet();
+  for(state_t src = 0; src < t->size(); src++) {
+    for(auto it = t->iterState(src); it != it.end(); ++it) {
+      TransitionView tr = it.transition();
+      u_fprintf(out, "%d\t%d\t", src, it.target());
+      for(auto& sym : tr.symbols) {
+        alphabet.write_symbol(out, sym, true);
+        u_fprintf(out, "\t");
+      }
+      if(writeWeights) {
+        u_fprintf(out, "%f", tr.weight);
       }
+      u_fprintf(out, "\n");
     }
   }
   for(auto& fin : t->getFinals()) {
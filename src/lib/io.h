@@ -2,13 +2,27 @@
 #define _LIB_IO_H_
 
 #include <cstdio>
+#include <vector>
 #include <unicode/ustdio.h>
 #include "transducer.h"
+#include "frozen_transducer.h"
 
 Transducer* readBin(FILE* in);
-void writeBin(Transducer* t, FILE* out);
+// read directly into the frozen representation
+// without building an intermediate Transducer
+FrozenTransducer* readFrozenBin(FILE* in);
+// If reorder is set, the symbols are first renumbered with
+// reorderSymbols() (unless the alphabet is shared) to make the file smaller.
+void writeBin(const TransducerView* t, FILE* out, bool reorder = false);
+// The pieces of writeBin(), for writers which produce the transitions
+// one state at a time: the header (including the finals of t), then
+// the number of states, then writeBinState() for each state in order
+// with its transitions ordered by target.
+void writeBinHeader(const TransducerView* t, bool write_weights, FILE* out);
+void writeBinState(const std::vector<std::pair<state_t, Transition>>& arcs, FILE* out);
 
-Transducer* readATT(UFILE* in);
-void writeATT(Transducer* t, UFILE* out, bool writeHeaders, bool writeWeights);
+// if alphabet is given, the result shares it
+Transducer* readATT(UFILE* in, std::shared_ptr<SymbolTable> alphabet = nullptr);
+void writeATT(const TransducerView* t, UFILE* out, bool writeHeaders, bool writeWeights);
 
 #endif
@@ -0,0 +1,170 @@
+#include "lazy_composition.h"
+#include <memory>
+#include <set>
+#include <stdexcept>
+
+LazyComposition::LazyComposition(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon, ComposeFilter filter, size_t cacheSize_) :
+  comp(a, b, tapes, flagsAsEpsilon, filter),
+  cacheSize(cacheSize_ > 0 ? cacheSize_ : 1)
+{
+  ComposedState init = comp.initialState();
+  lookup(init);
+}
+
+LazyComposition::~LazyComposition()
+{
+  delete comp.t;
+}
+
+void
+LazyComposition::keepTapes(const std::vector<UnicodeString>& names)
+{
+  comp.keepTapes(names);
+}
+
+void
+LazyComposition::setLimits(const ComposeLimits& limits)
+{
+  comp.setLimits(limits);
+}
+
+state_t
+LazyComposition::lookup(ComposedState& s) const
+{
+  auto loc = ids.try_emplace(comp.makeKey(s), states.size());
+  if(loc.second) {
+    s.out_state = loc.first->second;
+    states.push_back(s);
+    expanded.push_back(false);
+  }
+  return loc.first->second;
+}
+
+std::shared_ptr<const LazyComposition::ArcMap>
+LazyComposition::expand(state_t state) const
+{
+  auto loc = cache.find(state);
+  if(loc != cache.end()) {
+    recent.splice(recent.begin(), recent, loc->second.second);
+    return loc->second.first;
+  }
+  if(state >= states.size()) {
+    throw std::out_of_range("State has not been reached in lazy composition.");
+  }
+  size_t arcs_before = comp.arc_count;
+  comp.expandState(scratch, states[state]);
+  if(!expanded[state]) {
+    expanded[state] = true;
+    if(scratch.final) {
+      finals[state] = 0.000;
+    }
+  } else {
+    // these transitions were counted when the state was first expanded
+    comp.arc_count = arcs_before;
+  }
+  auto arcs = std::make_shared<ArcMap>();
+  for(auto& it : scratch.arcs) {
+    (*arcs)[lookup(it.first)].push_back(it.second);
+  }
+  comp.checkLimits(states.size());
+  recent.push_front(state);
+  cache[state] = std::make_pair(arcs, recent.begin());
+  if(cache.size() > cacheSize) {
+    cache.erase(recent.back());
+    recent.pop_back();
+  }
+  return arcs;
+}
+
+const SymbolTable&
+LazyComposition::getAlphabet() const
+{
+  return comp.t->getAlphabet();
+}
+
+std::shared_ptr<SymbolTable>
+LazyComposition::getSharedAlphabet() const
+{
+  return comp.t->getSharedAlphabet();
+}
+
+bool
+LazyComposition::isLazy() const
+{
+  return true;
+}
+
+const std::map<state_t, double>&
+LazyComposition::getFinals() const
+{
+  return finals;
+}
+
+const std::map<UnicodeString, TapeInfo>&
+LazyComposition::getTapeInfo() const
+{
+  return comp.t->getTapeInfo();
+}
+
+size_t
+LazyComposition::getTapeCount() const
+{
+  return comp.t->getTapeCount();
+}
+
+size_t
+LazyComposition::size() const
+{
+  return states.size();
+}
+
+bool
+LazyComposition::isFinal(state_t state) const
+{
+  if(state < states.size() && !expanded[state]) {
+    expand(state);
+  }
+  return finals.find(state) != finals.end();
+}
+
+TransitionIterator
+LazyComposition::iterState(state_t state) const
+{
+  return TransitionIterator(expand(state));
+}
+
+Transducer*
+composeCascade(const std::vector<const TransducerView*>& stages, const std::vector<std::vector<std::pair<UnicodeString, UnicodeString>>>& tapes, bool flagsAsEpsilon, ComposeFilter filter, size_t cacheSize, const std::vector<UnicodeString>& keep, const ComposeLimits& limits)
+{
+  if(stages.size() < 2 || tapes.size() != stages.size() - 1) {
+    throw std::invalid_argument("Cascade needs one set of compose tapes between each pair of transducers.");
+  }
+  std::vector<std::unique_ptr<LazyComposition>> chain;
+  const TransducerView* left = stages[0];
+  for(size_t i = 1; i + 1 < stages.size(); i++) {
+    chain.push_back(std::make_unique<LazyComposition>(left, stages[i], tapes[i-1], flagsAsEpsilon, filter, cacheSize));
+    chain.back()->setLimits(limits);
+    if(!keep.empty()) {
+      std::set<UnicodeString> needed(keep.begin(), keep.end());
+      for(size_t j = i; j < tapes.size(); j++) {
+        for(auto& it : tapes[j]) {
+          needed.insert(it.first);
+        }
+      }
+      std::vector<UnicodeString> names;
+      for(auto& it : chain.back()->getTapeInfo()) {
+        if(needed.find(it.first) != needed.end()) {
+          names.push_back(it.first);
+        }
+      }
+      chain.back()->keepTapes(names);
+    }
+    left = chain.back().get();
+  }
+  Composer comp(left, stages.back(), tapes.back(), flagsAsEpsilon, filter);
+  comp.setLimits(limits);
+  if(!keep.empty()) {
+    comp.keepTapes(keep);
+  }
+  return comp.compose();
+}
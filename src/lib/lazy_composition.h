@@ -0,0 +1,67 @@
+#ifndef _LIB_LAZY_COMPOSITION_H_
+#define _LIB_LAZY_COMPOSITION_H_
+
+#include "compose.h"
+#include "transducer_view.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// The composition of two transducers, computed one state at a time as
+// states are visited rather than all at once.
+// States are numbered in the order they are first reached, so the
+// numbering depends on the traversal. size() and getFinals() only cover
+// the states reached so far. Every state keeps its id, but only the
+// transitions of the most recently visited cacheSize states are kept,
+// and the rest are recomputed if they are visited again.
+// Not safe to use from several threads at once.
+class LazyComposition : public TransducerView {
+private:
+  typedef std::map<state_t, std::vector<Transition>> ArcMap;
+
+  mutable Composer comp;
+  mutable ComposeScratch scratch;
+  mutable std::vector<ComposedState> states;
+  mutable std::unordered_map<ComposedStateKey, state_t> ids;
+  mutable std::vector<bool> expanded;
+  mutable std::map<state_t, double> finals;
+
+  size_t cacheSize;
+  mutable std::list<state_t> recent;
+  mutable std::unordered_map<state_t, std::pair<std::shared_ptr<const ArcMap>, std::list<state_t>::iterator>> cache;
+
+  state_t lookup(ComposedState& s) const;
+  std::shared_ptr<const ArcMap> expand(state_t state) const;
+public:
+  LazyComposition(const TransducerView* a, const TransducerView* b, std::vector<std::pair<UnicodeString, UnicodeString>> tapes, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter, size_t cacheSize = 4096);
+  ~LazyComposition();
+  // see Composer::keepTapes(); must be called before any state is visited
+  void keepTapes(const std::vector<UnicodeString>& names);
+  // see Composer::setLimits(); the states and transitions counted are
+  // those reached so far, each only once however often it is recomputed
+  void setLimits(const ComposeLimits& limits);
+
+  const SymbolTable& getAlphabet() const override;
+  std::shared_ptr<SymbolTable> getSharedAlphabet() const override;
+  bool isLazy() const override;
+  const std::map<state_t, double>& getFinals() const override;
+  const std::map<UnicodeString, TapeInfo>& getTapeInfo() const override;
+  size_t getTapeCount() const override;
+  size_t size() const override;
+  bool isFinal(state_t state) const override;
+  TransitionIterator iterState(state_t state) const override;
+};
+
+// Composes stages[0] with stages[1] along tapes[0], the result of that
+// with stages[2] along tapes[1], and so on.
+// Every step except the last is a LazyComposition, so the intermediate
+// results are only expanded as far as the final composition reaches.
+// If keep is not empty, the result only has those tapes, and each
+// intermediate result only has those and the ones later steps compose on.
+// The limits apply to each step separately.
+Transducer* composeCascade(const std::vector<const TransducerView*>& stages, const std::vector<std::vector<std::pair<UnicodeString, UnicodeString>>>& tapes, bool flagsAsEpsilon = true, ComposeFilter filter = TrivialFilter, size_t cacheSize = 4096, const std::vector<UnicodeString>& keep = std::vector<UnicodeString>(), const ComposeLimits& limits = ComposeLimits());
+
+#endif
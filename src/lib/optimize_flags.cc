@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "utils/set_utils.h"
+#include "flags.h"
 #include "relabel.h"
 #include "strip.h"
 
@@ -30,14 +31,13 @@ updateState(std::map<string_ref, std::set<int>>& state, std::map<string_ref, std
 }
 
 Transducer*
-optimizeFlags(Transducer* t)
+optimizeFlags(const TransducerView* t)
 {
-  std::map<string_ref, FlagSymbolStruct> flags;
+  const SymbolTable& alphabet = t->getAlphabet();
   std::set<string_ref> flagNames;
   std::map<string_ref, std::set<string_ref>> flagValues;
-  for(auto it : t->getAlphabet().getDefined()) {
+  for(auto& it : alphabet.getDefined()) {
     if(it.second.type == FlagSymbol) {
-      flags[it.first] = it.second.flag;
       flagNames.insert(it.second.flag.sym);
       if(it.second.flag.val != string_ref(0)) {
         flagValues[it.second.flag.sym].insert(it.second.flag.val);
@@ -58,11 +58,14 @@ optimizeFlags(Transducer* t)
     state_t cur = todo.front();
     todo.pop_front();
     reached.insert(cur);
-    for(auto it : t->getTransitions()[cur]) {
-      state_t next = it.first;
+    // transitions are ordered by target, so each group of transitions
+    // to the same state is handled together
+    for(auto it = t->iterState(cur); it != it.end(); ) {
+      state_t next = it.target();
       bool changed = false;
       connected[cur][next] = false;
-      for(auto tr : it.second) {
+      for(; it != it.end() && it.target() == next; ++it) {
+        TransitionView tr = it.transition();
         std::map<string_ref, std::set<int>> cur_state = states[cur];
         bool reachable = true;
         std::set<string_ref> seen_here;
@@ -72,62 +75,29 @@ optimizeFlags(Transducer* t)
           } else {
             seen_here.insert(sym);
           }
-          if(flags.find(sym) != flags.end()) {
-            string_ref name = flags[sym].sym;
-            int val = (int)flags[sym].val.i;
-            switch(flags[sym].type) {
-              case Clear:
-                cur_state[name].clear();
-                cur_state[name].insert(0);
-                break;
-              case Positive:
-                cur_state[name].clear();
-                cur_state[name].insert(val);
-                break;
-              case Negative:
-                cur_state[name].clear();
-                cur_state[name].insert(-val);
-                break;
-              case Require:
-                required[name].insert(flags[sym].val);
-                if(val == 0) {
-                  cur_state[name].erase(0);
-                  if(cur_state[name].empty()) {
-                    reachable = false;
-                  }
-                } else if(cur_state[name].find(val) != cur_state[name].end()) {
-                  cur_state[name].clear();
-                  cur_state[name].insert(val);
-                } else {
-                  reachable = false;
-                }
-                break;
-              case Disallow:
-                required[name].insert(flags[sym].val);
-                if(val == 0) {
-                  if(cur_state[name].find(0) == cur_state[name].end()) {
-                    reachable = false;
-                  }
-                  cur_state[name].clear();
-                  cur_state[name].insert(0);
-                } else {
-                  cur_state[name].erase(val);
-                }
-                break;
-              case Unification:
-                if(!cur_state[name].empty() &&
-                   cur_state[name].find(0) == cur_state[name].end() &&
-                   cur_state[name].find(val) == cur_state[name].end()) {
-                  reachable = false;
-                }
-                if(cur_state[name].size() > 1 ||
-                   (cur_state[name].size() == 1 && *cur_state[name].begin() != 0)) {
-                  required[name].insert(flags[sym].val);
-                }
-                cur_state[name].clear();
-                cur_state[name].insert(val);
-                break;
+          if(alphabet.hasProperty(sym, SymbolProperty_Flag)) {
+            const FlagSymbolStruct& flag = alphabet.lookup(sym).flag;
+            std::set<int>& values = cur_state[flag.sym];
+            // note which values of the feature make a difference somewhere
+            if(flag.type == Require || flag.type == Disallow) {
+              required[flag.sym].insert(flag.val);
+            } else if(flag.type == Unification &&
+                      (values.size() > 1 ||
+                       (values.size() == 1 && *values.begin() != 0))) {
+              required[flag.sym].insert(flag.val);
             }
+            std::set<int> next_values;
+            for(int val : values) {
+              if(applyFlag(flag, val)) {
+                next_values.insert(val);
+              }
+            }
+            // blocked whatever value the feature has here, which includes
+            // @D.f.v@ when f can only be v
+            if(next_values.empty()) {
+              reachable = false;
+            }
+            values.swap(next_values);
           }
         }
         if(reachable) {
@@ -142,8 +112,24 @@ optimizeFlags(Transducer* t)
       }
     }
   }
-  std::map<string_ref, string_ref> update;
-  SymbolTable& alpha = t->getAlphabet();
+  // symbols not yet given a replacement are left as they are
+  std::vector<string_ref> update;
+  auto replace = [&update](string_ref from, string_ref to) {
+    for(unsigned int i = (unsigned int)update.size(); i <= from.i; i++) {
+      update.push_back(string_ref(i));
+    }
+    update[from.i] = to;
+  };
+  const FlagSymbolType types[] = {Clear, Positive, Negative, Require, Disallow, Unification};
+  // the merged flags may not exist yet, so build them in a copy
+  // which then replaces the alphabet of the result,
+  // unless the alphabet is shared, since that can be added to
+  std::shared_ptr<SymbolTable> shared = t->getSharedAlphabet();
+  SymbolTable copy;
+  if(!shared) {
+    copy = t->getAlphabet();
+  }
+  SymbolTable& alpha = (shared ? *shared : copy);
   for(auto flag : flagNames) {
     std::set<string_ref> needed;
     std::set<string_ref> unused;
@@ -161,12 +147,9 @@ optimizeFlags(Transducer* t)
     }
     if(drop) {
       for(auto val : unused) {
-        update[alpha.makeFlag(Clear,       flag, val)] = string_ref(0);
-        update[alpha.makeFlag(Positive,    flag, val)] = string_ref(0);
-        update[alpha.makeFlag(Negative,    flag, val)] = string_ref(0);
-        update[alpha.makeFlag(Require,     flag, val)] = string_ref(0);
-        update[alpha.makeFlag(Disallow,    flag, val)] = string_ref(0);
-        update[alpha.makeFlag(Unification, flag, val)] = string_ref(0);
+        for(auto type : types) {
+          replace(alpha.makeFlag(type, flag, val), string_ref(0));
+        }
       }
       unused.clear();
     }
@@ -209,15 +192,16 @@ optimizeFlags(Transducer* t)
           it.second.insert(key);
         }
       }
-      update[alpha.makeFlag(Clear,       flag, m)] = alpha.makeFlag(Clear,       flag, key);
-      update[alpha.makeFlag(Positive,    flag, m)] = alpha.makeFlag(Positive,    flag, key);
-      update[alpha.makeFlag(Negative,    flag, m)] = alpha.makeFlag(Negative,    flag, key);
-      update[alpha.makeFlag(Require,     flag, m)] = alpha.makeFlag(Require,     flag, key);
-      update[alpha.makeFlag(Disallow,    flag, m)] = alpha.makeFlag(Disallow,    flag, key);
-      update[alpha.makeFlag(Unification, flag, m)] = alpha.makeFlag(Unification, flag, key);
+      for(auto type : types) {
+        string_ref to = alpha.makeFlag(type, flag, key);
+        replace(alpha.makeFlag(type, flag, m), to);
+      }
     }
   }
   Transducer* rel = relabel(t, update);
+  if(!shared) {
+    rel->getAlphabet() = alpha;
+  }
   for(auto it : connected) {
     for(auto it2 : it.second) {
       if(!it2.second) {
@@ -3,6 +3,6 @@
 
 #include "transducer.h"
 
-Transducer* optimizeFlags(Transducer* t);
+Transducer* optimizeFlags(const TransducerView* t);
 
 #endif
@@ -1,27 +1,36 @@
 #include "relabel.h"
+#include "utils/tape_count.h"
 
-Transducer*
-relabel(Transducer* t, std::map<string_ref, string_ref>& update)
+template<typename Tapes>
+void
+relabelTransitions(const TransducerView* t, Transducer* ret, const std::vector<string_ref>& update)
 {
-  Transducer* ret = t->emptyCopy();
-  ret->addStates(t->size()-1);
-  auto trans = t->getTransitions();
-  for(size_t src = 0; src < trans.size(); src++) {
-    for(auto it : trans[src]) {
-      for(auto old_tr : it.second) {
-        Transition new_tr;
-        new_tr.symbols = old_tr.symbols;
-        new_tr.weight = old_tr.weight;
-        for(size_t i = 0; i < new_tr.symbols.size(); i++) {
-          if(update.find(new_tr.symbols[i]) != update.end()) {
-            new_tr.symbols[i] = update[old_tr.symbols[i]];
-          }
+  Transition new_tr;
+  for(state_t src = 0; src < t->size(); src++) {
+    for(auto it = t->iterState(src); it != it.end(); ++it) {
+      TransitionView tr = it.transition();
+      new_tr.symbols.assign(tr.symbols.begin(), tr.symbols.end());
+      new_tr.weight = tr.weight;
+      for(size_t i = 0; i < Tapes::count(tr.symbols.size()); i++) {
+        string_ref sym = tr.symbols[i];
+        if(sym.i < update.size()) {
+          new_tr.symbols[i] = update[sym.i];
         }
-        ret->insertTransition(src, it.first, new_tr);
       }
+      ret->insertTransition(src, it.target(), new_tr);
     }
   }
-  for(auto it : t->getFinals()) {
+}
+
+Transducer*
+relabel(const TransducerView* t, const std::vector<string_ref>& update)
+{
+  Transducer* ret = t->emptyCopy();
+  ret->addStates(t->size()-1);
+  dispatchTapes(t->getTapeCount(), [&](auto tapes) {
+    relabelTransitions<decltype(tapes)>(t, ret, update);
+  });
+  for(auto& it : t->getFinals()) {
     ret->setFinal(it.first, it.second);
   }
   return ret;
@@ -2,8 +2,10 @@
 #define _LIB_RELABEL_H_
 
 #include "transducer.h"
-#include <map>
+#include <vector>
 
-Transducer* relabel(Transducer* t, std::map<string_ref, string_ref>& update);
+// Replace each symbol s by update[s], leaving symbols past the end of
+// update as they are.
+Transducer* relabel(const TransducerView* t, const std::vector<string_ref>& update);
 
 #endif
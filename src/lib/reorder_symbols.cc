@@ -0,0 +1,39 @@
+#include "reorder_symbols.h"
+#include "relabel.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+Transducer*
+reorderSymbols(const TransducerView* t)
+{
+  if(t->getSharedAlphabet()) {
+    throw std::invalid_argument("Cannot renumber the symbols of a shared alphabet");
+  }
+  const SymbolTable& alpha = t->getAlphabet();
+  const std::vector<UnicodeString>& names = alpha.getSymbols();
+  std::vector<size_t> counts(names.size(), 0);
+  for(state_t state = 0; state < t->size(); state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      for(auto sym : it.transition().symbols) {
+        counts[sym.i]++;
+      }
+    }
+  }
+  // epsilon stays 0
+  std::vector<unsigned int> order(names.size() - 1);
+  std::iota(order.begin(), order.end(), 1);
+  std::stable_sort(order.begin(), order.end(),
+                   [&counts](unsigned int a, unsigned int b) {
+                     return counts[a] > counts[b];
+                   });
+  SymbolTable sorted;
+  for(auto id : order) {
+    sorted.internName(names[id]);
+  }
+  // this also renumbers the symbols in definitions
+  std::vector<string_ref> update = sorted.merge(alpha);
+  Transducer* ret = relabel(t, update);
+  ret->getAlphabet() = sorted;
+  return ret;
+}
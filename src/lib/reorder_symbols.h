@@ -0,0 +1,14 @@
+#ifndef _LIB_REORDER_SYMBOLS_H_
+#define _LIB_REORDER_SYMBOLS_H_
+
+#include "transducer.h"
+
+// Renumber the symbols of t so that the ones on the most transitions
+// have the smallest ids, which take fewer bytes in the binary format.
+// Symbols which are only used in the definitions of other symbols come
+// last, and ties keep their current order.
+// t must not have a shared alphabet, since that would change the ids
+// of every other transducer using it.
+Transducer* reorderSymbols(const TransducerView* t);
+
+#endif
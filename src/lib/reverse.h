@@ -3,6 +3,6 @@
 
 #include "transducer.h"
 
-Transducer* reverse(Transducer* t);
+Transducer* reverse(const TransducerView* t);
 
 #endif
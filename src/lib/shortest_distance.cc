@@ -0,0 +1,56 @@
+#include "shortest_distance.h"
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+std::vector<double>
+distanceToFinal(const TransducerView* t)
+{
+  size_t n = t->size();
+  // incoming transitions in compressed sparse row form
+  std::vector<size_t> in_start(n + 1, 0);
+  for(state_t state = 0; state < n; state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      if(it->second.weight < 0) {
+        throw std::invalid_argument("Shortest distance requires non-negative weights.");
+      }
+      in_start[it->first + 1]++;
+    }
+  }
+  for(size_t i = 0; i < n; i++) {
+    in_start[i + 1] += in_start[i];
+  }
+  std::vector<std::pair<state_t, double>> in_arcs(in_start[n]);
+  std::vector<size_t> fill(in_start.begin(), in_start.end() - 1);
+  for(state_t state = 0; state < n; state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      in_arcs[fill[it->first]++] = std::make_pair(state, it->second.weight);
+    }
+  }
+
+  std::vector<double> dist(n, std::numeric_limits<double>::infinity());
+  typedef std::pair<double, state_t> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> todo;
+  for(auto& it : t->getFinals()) {
+    if(it.first < n) {
+      dist[it.first] = 0;
+      todo.push(std::make_pair(0.0, it.first));
+    }
+  }
+  while(!todo.empty()) {
+    Entry cur = todo.top();
+    todo.pop();
+    if(cur.first > dist[cur.second]) {
+      continue;
+    }
+    for(size_t i = in_start[cur.second]; i < in_start[cur.second + 1]; i++) {
+      double d = cur.first + in_arcs[i].second;
+      if(d < dist[in_arcs[i].first]) {
+        dist[in_arcs[i].first] = d;
+        todo.push(std::make_pair(d, in_arcs[i].first));
+      }
+    }
+  }
+  return dist;
+}
@@ -0,0 +1,12 @@
+#ifndef _LIB_SHORTEST_DISTANCE_H_
+#define _LIB_SHORTEST_DISTANCE_H_
+
+#include "transducer_view.h"
+#include <vector>
+
+// For each state, the weight of the lightest path from it to a final
+// state (not counting final weights), or infinity if there is none.
+// Throws std::invalid_argument if any transition has negative weight.
+std::vector<double> distanceToFinal(const TransducerView* t);
+
+#endif
@@ -24,21 +24,24 @@ followLinks(std::map<state_t, std::vector<state_t>>& con,
 }
 
 Transducer*
-strip(Transducer* t)
+strip(const TransducerView* t)
 {
   std::map<state_t, std::vector<state_t>> forward, backward;
-  auto trans = t->getTransitions();
-  for(size_t state = 0; state < trans.size(); state++) {
-    for(auto it : trans[state]) {
-      forward[state].push_back(it.first);
-      backward[it.first].push_back(state);
+  for(state_t state = 0; state < t->size(); state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      state_t trg = it->first;
+      // transitions are ordered by target, so only record each link once
+      if(forward[state].empty() || forward[state].back() != trg) {
+        forward[state].push_back(trg);
+        backward[trg].push_back(state);
+      }
     }
   }
   std::set<state_t> accessible, coaccessible;
   std::deque<state_t> todo;
   todo.push_back(0);
   followLinks(forward, accessible, todo);
-  for(auto it : t->getFinals()) {
+  for(auto& it : t->getFinals()) {
     todo.push_back(it.first);
   }
   followLinks(backward, coaccessible, todo);
@@ -50,19 +53,18 @@ strip(Transducer* t)
     if(new_states.find(state) == new_states.end()) {
       new_states[state] = ret->addState();
     }
-    for(auto it : t->getTransitions()[state]) {
-      if(keep.find(it.first) == keep.end()) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      state_t trg = it->first;
+      if(keep.find(trg) == keep.end()) {
         continue;
       }
-      if(new_states.find(it.first) == new_states.end()) {
-        new_states[it.first] = ret->addState();
-      }
-      for(auto tr : it.second) {
-        ret->insertTransition(new_states[state], new_states[it.first], tr);
+      if(new_states.find(trg) == new_states.end()) {
+        new_states[trg] = ret->addState();
       }
+      ret->insertTransition(new_states[state], new_states[trg], it->second);
     }
   }
-  for(auto fin : t->getFinals()) {
+  for(auto& fin : t->getFinals()) {
     if(new_states.find(fin.first) != new_states.end()) {
       ret->setFinal(new_states[fin.first], fin.second);
     }
@@ -3,6 +3,6 @@
 
 #include "transducer.h"
 
-Transducer* strip(Transducer* t);
+Transducer* strip(const TransducerView* t);
 
 #endif
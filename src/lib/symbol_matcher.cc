@@ -0,0 +1,103 @@
+#include "symbol_matcher.h"
+#include "utils/icu-iter.h"
+#include <unicode/uchar.h>
+
+bool
+matchesCategory(SymbolClass cls, const UnicodeString& name)
+{
+  if(cls == SymbolClass_Any) {
+    return true;
+  } else if(cls == SymbolClass_Tag) {
+    return (name.length() > 2 && name[0] == '<' && name[name.length()-1] == '>');
+  } else if(name.countChar32() != 1) {
+    return false;
+  }
+  UChar32 c = name.char32At(0);
+  switch(cls) {
+    case SymbolClass_Char:
+      return true;
+    case SymbolClass_Upper:
+      return u_isupper(c);
+    case SymbolClass_Lower:
+      return u_islower(c);
+    default:
+      return false;
+  }
+}
+
+SymbolMatcher::SymbolMatcher() :
+  count(0), words(0)
+{
+}
+
+SymbolMatcher::SymbolMatcher(const SymbolTable& table, bool flagsAsEpsilon)
+{
+  const std::vector<UnicodeString>& names = table.getSymbols();
+  const std::map<string_ref, SymbolExpansion>& defined = table.getDefined();
+  count = names.size();
+  words = (count + 63) / 64;
+  epsilon.resize(words, 0);
+  plain.resize(words, 0);
+  rows.resize(count, 0);
+  identities.resize(count, 0);
+
+  set(epsilon.data(), 0);
+  for(size_t i = 1; i < count; i++) {
+    set(plain.data(), i);
+  }
+  size_t setCount = 0;
+  for(auto& it : defined) {
+    size_t i = it.first.i;
+    plain[i >> 6] &= ~((uint64_t)1 << (i & 63));
+    switch(it.second.type) {
+      case FlagSymbol:
+        if(flagsAsEpsilon) {
+          set(epsilon.data(), i);
+        }
+        break;
+      case IdentitySymbol:
+        identities[i] = it.second.tape + 1;
+        break;
+      default:
+        rows[i] = ++setCount;
+        break;
+    }
+  }
+
+  sets.resize(setCount * words, 0);
+  for(auto& it : defined) {
+    if(rows[it.first.i] == 0) {
+      continue;
+    }
+    uint64_t* row = sets.data() + (rows[it.first.i] - 1) * words;
+    const SymbolExpansion& exp = it.second;
+    switch(exp.type) {
+      case UnionSymbol:
+        for(auto sym : exp.syms) {
+          if(sym.i < count) {
+            set(row, sym.i);
+          }
+        }
+        break;
+      case NegationSymbol:
+        for(size_t w = 0; w < words; w++) {
+          row[w] = plain[w];
+        }
+        for(auto sym : exp.syms) {
+          if(sym.i < count) {
+            row[sym.i >> 6] &= ~((uint64_t)1 << (sym.i & 63));
+          }
+        }
+        break;
+      case CategorySymbol:
+        for(size_t i = 1; i < count; i++) {
+          if(test(plain.data(), i) && matchesCategory(exp.cls, names[i])) {
+            set(row, i);
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef _LIB_SYMBOL_MATCHER_H_
+#define _LIB_SYMBOL_MATCHER_H_
+
+#include "symbol_table.h"
+#include <cstdint>
+#include <vector>
+
+// The symbol definitions of a SymbolTable compiled into bitmaps over
+// symbol ids, so that checking whether a symbol is an epsilon or
+// whether a Union, Negation, or Category symbol can stand for a given
+// plain symbol is a single bit test.
+// Only covers the symbols in the table when the matcher was built;
+// later symbols are treated as plain.
+class SymbolMatcher {
+private:
+  size_t count;
+  size_t words;
+  std::vector<uint64_t> epsilon;
+  std::vector<uint64_t> plain;
+  std::vector<uint64_t> sets;
+  // for each symbol, 1 + its row in sets, or 0 if it isn't a set
+  std::vector<size_t> rows;
+  // for each symbol, 1 + the tape it is an identity of, or 0
+  std::vector<size_t> identities;
+
+  static bool test(const uint64_t* bits, size_t i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+  }
+  static void set(uint64_t* bits, size_t i) {
+    bits[i >> 6] |= ((uint64_t)1 << (i & 63));
+  }
+public:
+  SymbolMatcher();
+  SymbolMatcher(const SymbolTable& table, bool flagsAsEpsilon);
+
+  bool isEpsilon(string_ref sym) const {
+    return sym.i == 0 || (sym.i < count && test(epsilon.data(), sym.i));
+  }
+  // Union, Negation, and Category symbols
+  bool isSet(string_ref sym) const {
+    return sym.i < count && rows[sym.i] != 0;
+  }
+  bool isIdentity(string_ref sym) const {
+    return sym.i < count && identities[sym.i] != 0;
+  }
+  size_t identityTape(string_ref sym) const {
+    return identities[sym.i] - 1;
+  }
+  // whether the set symbol set can stand for the plain symbol sym
+  bool matches(string_ref set, string_ref sym) const {
+    if(!isSet(set)) {
+      return false;
+    } else if(sym.i >= count) {
+      return false;
+    }
+    return test(sets.data() + (rows[set.i] - 1) * words, sym.i);
+  }
+};
+
+#endif
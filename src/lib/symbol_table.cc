@@ -1,8 +1,12 @@
 #include "symbol_table.h"
 #include "utils/compression.h"
 #include "utils/icu-iter.h"
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <unicode/ustream.h>
+#include <utility>
 
 bool
 operator==(const SymbolExpansion& a, const SymbolExpansion& b)
@@ -24,15 +28,151 @@ operator!=(const SymbolExpansion& a, const SymbolExpansion& b)
             a.flag.val != b.flag.val)));
 }
 
-SymbolTable::SymbolTable()
+SymbolTable::SymbolTable() :
+  chunk_next(nullptr),
+  chunk_left(0)
 {
   internName("");
 }
 
+SymbolTable::SymbolTable(const SymbolTable& other) :
+  chunk_next(nullptr),
+  chunk_left(0)
+{
+  *this = other;
+}
+
+SymbolTable&
+SymbolTable::operator=(const SymbolTable& other)
+{
+  if(this == &other) {
+    return *this;
+  }
+  clearNames();
+  for(size_t i = 0; i < other.id_to_name.size(); i++) {
+    storeName(view(other.id_to_name[i]), other.name_hashes[i]);
+  }
+  slots = other.slots;
+  clearDefinitions();
+  for(auto& it : other.symbols) {
+    define(it.first, it.second);
+  }
+  return *this;
+}
+
+SymbolTable::SymbolTable(SymbolTable&& other) noexcept :
+  chunk_next(nullptr),
+  chunk_left(0)
+{
+  *this = std::move(other);
+}
+
+SymbolTable&
+SymbolTable::operator=(SymbolTable&& other) noexcept
+{
+  if(this == &other) {
+    return *this;
+  }
+  // the chunks, and the map nodes which expansions points to,
+  // move with their owners, so none of the pointers change
+  chunks = std::move(other.chunks);
+  chunk_next = other.chunk_next;
+  chunk_left = other.chunk_left;
+  id_to_name = std::move(other.id_to_name);
+  name_hashes = std::move(other.name_hashes);
+  slots = std::move(other.slots);
+  symbols = std::move(other.symbols);
+  expansions = std::move(other.expansions);
+  properties = std::move(other.properties);
+  // otherwise other would go on writing names into our last chunk
+  other.clearNames();
+  return *this;
+}
+
 SymbolTable::~SymbolTable()
 {
 }
 
+std::u16string_view
+SymbolTable::view(const UnicodeString& s)
+{
+  return std::u16string_view(s.getBuffer(), (size_t)s.length());
+}
+
+void
+SymbolTable::storeName(std::u16string_view name, size_t hash)
+{
+  if(chunk_left < name.size() + 1) {
+    size_t size = std::max(CHUNK, name.size() + 1);
+    chunks.push_back(std::make_unique<char16_t[]>(size));
+    chunk_next = chunks.back().get();
+    chunk_left = size;
+  }
+  char16_t* loc = chunk_next;
+  std::memcpy(loc, name.data(), name.size() * sizeof(char16_t));
+  loc[name.size()] = 0;
+  chunk_next += name.size() + 1;
+  chunk_left -= name.size() + 1;
+  id_to_name.push_back(UnicodeString(true, loc, (int32_t)name.size()));
+  name_hashes.push_back(hash);
+  const UnicodeString& str = id_to_name.back();
+  unsigned char prop = 0;
+  if(name.empty()) {
+    prop |= SymbolProperty_Epsilon;
+  } else if(name.size() > 2 && name.front() == '<' && name.back() == '>') {
+    prop |= SymbolProperty_Tag;
+  } else if(str.countChar32() == 1) {
+    prop |= SymbolProperty_Char;
+  }
+  properties.push_back(prop);
+  expansions.push_back(NULL);
+}
+
+void
+SymbolTable::growSlots()
+{
+  slots.assign(std::max(slots.size() * 2, (size_t)64), 0);
+  for(unsigned int id = 0; id < id_to_name.size(); id++) {
+    slots[findSlot(view(id_to_name[id]), name_hashes[id])] = id + 1;
+  }
+}
+
+size_t
+SymbolTable::findSlot(std::u16string_view name, size_t hash) const
+{
+  size_t mask = slots.size() - 1;
+  for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+    unsigned int id = slots[i];
+    if(id == 0 || (name_hashes[id-1] == hash && view(id_to_name[id-1]) == name)) {
+      return i;
+    }
+  }
+}
+
+void
+SymbolTable::clearNames()
+{
+  chunks.clear();
+  chunk_next = nullptr;
+  chunk_left = 0;
+  id_to_name.clear();
+  name_hashes.clear();
+  slots.clear();
+  properties.clear();
+  expansions.clear();
+  symbols.clear();
+}
+
+void
+SymbolTable::clearDefinitions()
+{
+  symbols.clear();
+  for(size_t i = 0; i < expansions.size(); i++) {
+    expansions[i] = NULL;
+    properties[i] &= (unsigned char)~(SymbolProperty_Flag | SymbolProperty_Complex);
+  }
+}
+
 const UnicodeString&
 SymbolTable::name(string_ref r) const
 {
@@ -42,22 +182,32 @@ SymbolTable::name(string_ref r) const
 string_ref
 SymbolTable::internName(const UnicodeString& name)
 {
-  if(name_to_id.find(name) == name_to_id.end())
-  {
-    name_to_id[name] = string_ref(id_to_name.size());
-    id_to_name.push_back(name);
+  std::u16string_view key = view(name);
+  size_t hash = std::hash<std::u16string_view>()(key);
+  if(!slots.empty()) {
+    unsigned int id = slots[findSlot(key, hash)];
+    if(id != 0) {
+      return string_ref(id - 1);
+    }
   }
-  return name_to_id[name];
+  if((id_to_name.size() + 1) * 2 > slots.size()) {
+    storeName(key, hash);
+    growSlots();
+  } else {
+    slots[findSlot(key, hash)] = (unsigned int)id_to_name.size() + 1;
+    storeName(key, hash);
+  }
+  return string_ref((unsigned int)id_to_name.size() - 1);
 }
 
 const std::vector<UnicodeString>&
-SymbolTable::getSymbols()
+SymbolTable::getSymbols() const
 {
   return id_to_name;
 }
 
 const std::map<string_ref, SymbolExpansion>&
-SymbolTable::getDefined()
+SymbolTable::getDefined() const
 {
   return symbols;
 }
@@ -65,14 +215,11 @@ SymbolTable::getDefined()
 void
 SymbolTable::read(FILE* in)
 {
-  id_to_name.clear();
-  name_to_id.clear();
+  clearNames();
   internName("");
   for(unsigned int i = 1, lim = Compression::multibyte_read(in); i < lim; i++) {
-    id_to_name.push_back(Compression::string_read(in));
-    name_to_id[id_to_name.back()] = string_ref(i);
+    internName(Compression::string_read(in));
   }
-  symbols.clear();
   for(unsigned int i = 0, lim = Compression::multibyte_read(in); i < lim; i++) {
     unsigned int sym = Compression::multibyte_read(in);
     SymbolExpansion exp;
@@ -99,12 +246,12 @@ SymbolTable::read(FILE* in)
         exp.flag.val = string_ref(Compression::multibyte_read(in));
         break;
     }
-    symbols[string_ref(sym)] = exp;
+    define(string_ref(sym), exp);
   }
 }
 
 void
-SymbolTable::write(FILE* out)
+SymbolTable::write(FILE* out) const
 {
   Compression::multibyte_write(id_to_name.size(), out);
   for(unsigned int i = 1; i < id_to_name.size(); i++) {
@@ -138,9 +285,9 @@ SymbolTable::write(FILE* out)
 }
 
 void
-SymbolTable::write_symbol(UFILE* out, string_ref sym, bool escape)
+SymbolTable::write_symbol(UFILE* out, string_ref sym, bool escape) const
 {
-  UnicodeString& s = id_to_name[(unsigned int)sym];
+  const UnicodeString& s = id_to_name[(unsigned int)sym];
   if(escape) {
     if(s == " ") {
       u_fprintf(out, "@_SPACE_@");
@@ -153,13 +300,13 @@ SymbolTable::write_symbol(UFILE* out, string_ref sym, bool escape)
       return;
     }
   }
-  u_fprintf(out, "%S", s.getTerminatedBuffer());
+  u_file_write(s.getBuffer(), s.length(), out);
 }
 
 void
-SymbolTable::write_symbol(UnicodeString& s, string_ref sym, bool escape)
+SymbolTable::write_symbol(UnicodeString& s, string_ref sym, bool escape) const
 {
-  UnicodeString& str = id_to_name[(unsigned int)sym];
+  const UnicodeString& str = id_to_name[(unsigned int)sym];
   if(escape) {
     if(str == " ") {
       s += "@_SPACE_@";
@@ -175,37 +322,58 @@ SymbolTable::write_symbol(UnicodeString& s, string_ref sym, bool escape)
   s += str;
 }
 
-std::map<string_ref, string_ref>
-SymbolTable::merge(SymbolTable& other)
+std::vector<string_ref>
+SymbolTable::merge(const SymbolTable& other)
 {
-  std::map<string_ref, string_ref> ret;
+  std::vector<string_ref> ret(other.id_to_name.size());
+  if(this == &other) {
+    for(unsigned int i = 0; i < ret.size(); i++) {
+      ret[i] = string_ref(i);
+    }
+    return ret;
+  }
   for(size_t i = 1; i < other.id_to_name.size(); i++) {
-    ret[string_ref(i)] = internName(other.id_to_name[i]);
+    ret[i] = internName(other.id_to_name[i]);
+  }
+  auto update = [&ret](string_ref sym) {
+    return ret[sym.i];
+  };
+  for(auto& it : other.symbols) {
+    SymbolExpansion exp = it.second;
+    exp.syms.clear();
+    for(auto sym : it.second.syms) {
+      exp.syms.insert(update(sym));
+    }
+    exp.flag.sym = update(exp.flag.sym);
+    exp.flag.val = update(exp.flag.val);
+    define(update(it.first), exp, true);
   }
-  // TODO: merge symbols
   return ret;
 }
 
 void
 SymbolTable::define(string_ref sym, SymbolExpansion exp, bool check)
 {
-  if(check && symbols.find(sym) != symbols.end() &&
-     symbols[sym] != exp) {
+  if(check && isDefined(sym) && *expansions[sym.i] != exp) {
     throw std::runtime_error("Multiple conflicting definitions for symbol.");
   }
-  symbols[sym] = exp;
-}
-
-bool
-SymbolTable::isDefined(string_ref sym)
-{
-  return symbols.find(sym) != symbols.end();
+  if(sym.i >= id_to_name.size()) {
+    throw std::runtime_error("Attempt to define symbol which has no name.");
+  }
+  SymbolExpansion& loc = symbols[sym];
+  loc = exp;
+  expansions[sym.i] = &loc;
+  properties[sym.i] &= (unsigned char)~(SymbolProperty_Flag | SymbolProperty_Complex);
+  properties[sym.i] |= (exp.type == FlagSymbol ? SymbolProperty_Flag : SymbolProperty_Complex);
 }
 
 const SymbolExpansion&
-SymbolTable::lookup(string_ref sym)
+SymbolTable::lookup(string_ref sym) const
 {
-  return symbols[sym];
+  if(!isDefined(sym)) {
+    throw std::runtime_error("Attempt to look up undefined symbol.");
+  }
+  return *expansions[sym.i];
 }
 
 void
@@ -255,19 +423,6 @@ SymbolTable::insertFlag(string_ref sym, FlagSymbolType type, string_ref flag, st
   define(sym, exp, check);
 }
 
-bool
-SymbolTable::isEpsilon(string_ref sym, bool flagsAsEpsilon)
-{
-  if(sym == string_ref(0)) {
-    return true;
-  } else if(flagsAsEpsilon && symbols.find(sym) != symbols.end() &&
-            symbols[sym].type == FlagSymbol) {
-    return true;
-  } else {
-    return false;
-  }
-}
-
 std::set<string_ref>
 split_comma(const UnicodeString& s, SymbolTable* table)
 {
@@ -283,6 +438,36 @@ split_comma(const UnicodeString& s, SymbolTable* table)
   return ret;
 }
 
+UnicodeString
+categoryName(SymbolClass cls)
+{
+  switch(cls) {
+    case SymbolClass_Tag:
+      return "@_TAG_@";
+    case SymbolClass_Char:
+      return "@_CHAR_@";
+    case SymbolClass_Upper:
+      return "@_UPPER_@";
+    case SymbolClass_Lower:
+      return "@_LOWER_@";
+    default:
+      return "@_ANY_@";
+  }
+}
+
+UnicodeString
+joinNames(const std::set<string_ref>& ls, const SymbolTable* table)
+{
+  UnicodeString ret;
+  for(auto sym : ls) {
+    if(!ret.isEmpty()) {
+      ret += ',';
+    }
+    ret += table->name(sym);
+  }
+  return ret;
+}
+
 string_ref
 SymbolTable::parseSymbol(const UnicodeString& s)
 {
@@ -299,6 +484,28 @@ SymbolTable::parseSymbol(const UnicodeString& s)
         exp.syms = syms;
         define(ret, exp, true);
         return ret;
+      } else if(s.startsWith("@_NOT_{") && s[s.length()-3] == '}') {
+        std::set<string_ref> syms = split_comma(s.tempSubStringBetween(7, s.length()-3), this);
+        exp.type = NegationSymbol;
+        exp.syms = syms;
+        define(ret, exp, true);
+        return ret;
+      } else if(s.startsWith("@_ID_") && s.length() > 7) {
+        size_t tape = 0;
+        for(int i = 5; i < s.length() - 2; i++) {
+          if(s[i] < '0' || s[i] > '9') {
+            return ret;
+          }
+          tape = tape*10 + (size_t)(s[i] - '0');
+        }
+        insertIdentity(ret, tape, true);
+        return ret;
+      }
+      for(int cls = SymbolClass_Any; cls <= SymbolClass_Lower; cls++) {
+        if(s == categoryName((SymbolClass)cls)) {
+          insertCategory(ret, (SymbolClass)cls, true);
+          return ret;
+        }
       }
     } else {
       exp.type = FlagSymbol;
@@ -337,15 +544,17 @@ SymbolTable::parseSymbol(const UnicodeString& s)
 string_ref
 SymbolTable::makeUnion(std::set<string_ref> ls)
 {
-  // TODO
-  return string_ref(0);
+  string_ref ret = internName("@_UNION_{" + joinNames(ls, this) + "}_@");
+  insertUnion(ret, ls, true);
+  return ret;
 }
 
 string_ref
 SymbolTable::makeNegation(std::set<string_ref> ls)
 {
-  // TODO
-  return string_ref(0);
+  string_ref ret = internName("@_NOT_{" + joinNames(ls, this) + "}_@");
+  insertNegation(ret, ls, true);
+  return ret;
 }
 
 string_ref
@@ -363,8 +572,9 @@ SymbolTable::makeIdentity(size_t tape_idx)
 string_ref
 SymbolTable::makeCategory(SymbolClass cls)
 {
-  // TODO
-  return string_ref(0);
+  string_ref ret = internName(categoryName(cls));
+  insertCategory(ret, cls, true);
+  return ret;
 }
 
 string_ref
@@ -404,7 +614,50 @@ SymbolTable::makeFlag(FlagSymbolType type, string_ref flag, string_ref val)
 }
 
 bool
-SymbolTable::isInterned(const UnicodeString& s)
+SymbolTable::isInterned(const UnicodeString& s) const
 {
-  return (name_to_id.find(s) != name_to_id.end());
+  if(slots.empty()) {
+    return false;
+  }
+  std::u16string_view key = view(s);
+  return slots[findSlot(key, std::hash<std::u16string_view>()(key))] != 0;
+}
+
+bool
+SymbolTable::extend(const SymbolTable& other)
+{
+  if(this == &other) {
+    return true;
+  }
+  size_t common = std::min(id_to_name.size(), other.id_to_name.size());
+  for(size_t i = 1; i < common; i++) {
+    if(name_hashes[i] != other.name_hashes[i] || id_to_name[i] != other.id_to_name[i]) {
+      return false;
+    }
+  }
+  for(auto& it : other.symbols) {
+    if(isDefined(it.first) && *expansions[it.first.i] != it.second) {
+      return false;
+    }
+  }
+  // the names past common are all new, so they get the same ids here
+  for(size_t i = common; i < other.id_to_name.size(); i++) {
+    internName(other.id_to_name[i]);
+  }
+  for(auto& it : other.symbols) {
+    define(it.first, it.second);
+  }
+  return true;
+}
+
+std::shared_ptr<SymbolTable>
+sharedAlphabet(const SymbolTable& alpha)
+{
+  static std::mutex lock;
+  static std::shared_ptr<SymbolTable> registry = std::make_shared<SymbolTable>();
+  std::lock_guard<std::mutex> guard(lock);
+  if(!registry->extend(alpha)) {
+    return nullptr;
+  }
+  return registry;
 }
@@ -2,7 +2,9 @@
 #define _LIB_SYMBOL_TABLE_H_
 
 #include <map>
+#include <memory>
 #include <set>
+#include <string_view>
 #include <vector>
 #include <cstdio>
 #include <unicode/ustdio.h>
@@ -62,6 +64,18 @@ enum FlagSymbolType {
   Unification = 6
 };
 
+// Properties of a symbol, as bits of SymbolTable::properties
+enum SymbolProperty {
+  SymbolProperty_Epsilon = 1,
+  SymbolProperty_Flag    = 2,
+  // Union, Negation, Identity, or Category
+  SymbolProperty_Complex = 4,
+  // named like <n>
+  SymbolProperty_Tag     = 8,
+  // a single character
+  SymbolProperty_Char    = 16
+};
+
 struct FlagSymbolStruct {
   FlagSymbolType type;
   string_ref sym;
@@ -81,28 +95,63 @@ bool operator!=(const SymbolExpansion& a, const SymbolExpansion& b);
 
 class SymbolTable {
 private:
-  std::map<UnicodeString, string_ref> name_to_id;
+  // The text of every name is stored NUL-terminated in chunks of
+  // CHUNK characters (or one chunk for a longer name), which never
+  // move, and id_to_name holds read-only aliases of it.
+  static constexpr size_t CHUNK = 1 << 16;
+  std::vector<std::unique_ptr<char16_t[]>> chunks;
+  char16_t* chunk_next;
+  size_t chunk_left;
   std::vector<UnicodeString> id_to_name;
+  std::vector<size_t> name_hashes;
+  // open addressing table of id+1, or 0 if empty, with a power of 2 size
+  std::vector<unsigned int> slots;
   std::map<string_ref, SymbolExpansion> symbols;
+  // indexed by id: the entry of symbols, or NULL if undefined
+  std::vector<const SymbolExpansion*> expansions;
+  // indexed by id: the SymbolProperty bits
+  std::vector<unsigned char> properties;
+
+  static std::u16string_view view(const UnicodeString& s);
+  void storeName(std::u16string_view name, size_t hash);
+  void growSlots();
+  // the slot which holds name, or the empty slot where it would go
+  size_t findSlot(std::u16string_view name, size_t hash) const;
+  void clearNames();
+  void clearDefinitions();
 public:
   SymbolTable();
+  SymbolTable(const SymbolTable& other);
+  // other is left without any names, not even epsilon,
+  // so it can only be assigned to or destroyed
+  SymbolTable(SymbolTable&& other) noexcept;
+  SymbolTable& operator=(const SymbolTable& other);
+  SymbolTable& operator=(SymbolTable&& other) noexcept;
   ~SymbolTable();
 
   const UnicodeString& name(string_ref r) const;
   string_ref internName(const UnicodeString& name);
 
-  const std::vector<UnicodeString>& getSymbols();
-  const std::map<string_ref, SymbolExpansion>& getDefined();
+  const std::vector<UnicodeString>& getSymbols() const;
+  const std::map<string_ref, SymbolExpansion>& getDefined() const;
 
   void read(FILE* in);
-  void write(FILE* out);
-  void write_symbol(UFILE* out, string_ref sym, bool escape);
-  void write_symbol(UnicodeString& s, string_ref sym, bool escape);
-  std::map<string_ref, string_ref> merge(SymbolTable& other);
+  void write(FILE* out) const;
+  void write_symbol(UFILE* out, string_ref sym, bool escape) const;
+  void write_symbol(UnicodeString& s, string_ref sym, bool escape) const;
+  // Add the symbols of other to this table,
+  // returning the new id of each id in other.
+  std::vector<string_ref> merge(const SymbolTable& other);
 
   void define(string_ref sym, SymbolExpansion exp, bool check = false);
-  bool isDefined(string_ref sym);
-  const SymbolExpansion& lookup(string_ref sym);
+  bool isDefined(string_ref sym) const {
+    return sym.i < expansions.size() && expansions[sym.i] != NULL;
+  }
+  bool hasProperty(string_ref sym, SymbolProperty prop) const {
+    return sym.i < properties.size() && (properties[sym.i] & prop);
+  }
+  // sym must be defined
+  const SymbolExpansion& lookup(string_ref sym) const;
 
   void insertUnion(string_ref sym, std::set<string_ref> ls, bool check = false);
   void insertNegation(string_ref sym, std::set<string_ref> ls, bool check = false);
@@ -118,9 +167,22 @@ public:
   string_ref makeCategory(SymbolClass cls);
   string_ref makeFlag(FlagSymbolType type, string_ref flag, string_ref val);
 
-  bool isEpsilon(string_ref sym, bool flagsAsEpsilon);
+  bool isEpsilon(string_ref sym, bool flagsAsEpsilon) const {
+    return sym.i == 0 || (flagsAsEpsilon && hasProperty(sym, SymbolProperty_Flag));
+  }
+
+  bool isInterned(const UnicodeString& s) const;
 
-  bool isInterned(const UnicodeString& s);
+  // If this table and other give the same name and definition to every
+  // id they both have, add the rest of other to this table and return
+  // true, otherwise leave this table as it is and return false.
+  bool extend(const SymbolTable& other);
 };
 
+// The symbol registry of this process, which transducers built against
+// a shared alphabet use instead of a table of their own.
+// alpha is added to it with extend(), and NULL is returned if it doesn't
+// agree with what is already there.
+std::shared_ptr<SymbolTable> sharedAlphabet(const SymbolTable& alpha);
+
 #endif
@@ -8,30 +8,27 @@
 #include <stdexcept>
 
 Transducer*
-cleanTransducer(Transducer* t, size_t input_tape, size_t* stringTapes)
+cleanTransducer(const TransducerView* t, size_t input_tape, size_t* stringTapes)
 {
-  auto alpha = t->getAlphabet();
+  const SymbolTable& alpha = t->getAlphabet();
   std::vector<std::set<string_ref>> sym_locs;
   std::vector<std::set<string_ref>> flag_locs;
   sym_locs.resize(t->getTapeCount());
   flag_locs.resize(t->getTapeCount());
-  for(auto state : t->getTransitions()) {
-    for(auto blob : state) {
-      for(auto tr : blob.second) {
-        for(size_t i = 0; i < tr.symbols.size(); i++) {
-          string_ref sym = tr.symbols[i];
-          if(sym == string_ref(0)) {
-            continue;
-          }
-          if(alpha.isDefined(sym)) {
-            if(alpha.lookup(sym).type != FlagSymbol) {
-              throw std::runtime_error("Complex symbols are not allowed in optimized lookup transducers.");
-            } else {
-              flag_locs[i].insert(sym);
-            }
-          } else {
-            sym_locs[i].insert(sym);
-          }
+  for(state_t state = 0; state < t->size(); state++) {
+    for(auto it = t->iterState(state); it != it.end(); ++it) {
+      const Transition& tr = it->second;
+      for(size_t i = 0; i < tr.symbols.size(); i++) {
+        string_ref sym = tr.symbols[i];
+        if(sym == string_ref(0)) {
+          continue;
+        }
+        if(alpha.hasProperty(sym, SymbolProperty_Complex)) {
+          throw std::runtime_error("Complex symbols are not allowed in optimized lookup transducers.");
+        } else if(alpha.hasProperty(sym, SymbolProperty_Flag)) {
+          flag_locs[i].insert(sym);
+        } else {
+          sym_locs[i].insert(sym);
         }
       }
     }
@@ -79,7 +76,7 @@ cleanTransducer(Transducer* t, size_t input_tape, size_t* stringTapes)
 }
 
 void
-toLookup(Transducer* t, FILE* out)
+toLookup(const TransducerView* t, FILE* out)
 {
   Transducer* temp = strip(t);
   size_t stringTapes;
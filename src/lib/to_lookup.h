@@ -4,6 +4,6 @@
 #include "transducer.h"
 #include <cstdio>
 
-void toLookup(Transducer* t, FILE* out);
+void toLookup(const TransducerView* t, FILE* out);
 
 #endif
@@ -1,10 +1,15 @@
 #include "transducer.h"
 #include "utils/compression.h"
+#include <algorithm>
+#include <numeric>
 #include <stdexcept>
+#include <unordered_map>
 #include <unicode/ustream.h>
 
 Transducer::Transducer(size_t tp) :
-  tapeCount(tp)
+  tapeCount(tp),
+  alphabet(std::make_shared<SymbolTable>()),
+  alphabetShared(false)
 {
   addState();
 }
@@ -14,18 +19,58 @@ Transducer::~Transducer()
 }
 
 Transducer*
-Transducer::emptyCopy()
+TransducerView::emptyCopy() const
 {
-  Transducer* ret = new Transducer(tapeCount);
-  ret->alphabet = alphabet;
-  ret->tapeNames = tapeNames;
+  Transducer* ret = new Transducer(getTapeCount());
+  ret->copyAlphabet(this);
+  ret->setTapeInfo(getTapeInfo());
   return ret;
 }
 
 SymbolTable&
 Transducer::getAlphabet()
 {
-  return alphabet;
+  return *alphabet;
+}
+
+const SymbolTable&
+Transducer::getAlphabet() const
+{
+  return *alphabet;
+}
+
+std::shared_ptr<SymbolTable>
+Transducer::getSharedAlphabet() const
+{
+  return (alphabetShared ? alphabet : nullptr);
+}
+
+void
+Transducer::shareAlphabet(std::shared_ptr<SymbolTable> alpha)
+{
+  alphabet = alpha;
+  alphabetShared = true;
+}
+
+void
+Transducer::copyAlphabet(const TransducerView* other)
+{
+  std::shared_ptr<SymbolTable> shared = other->getSharedAlphabet();
+  if(shared) {
+    shareAlphabet(shared);
+  } else {
+    alphabet = std::make_shared<SymbolTable>(other->getAlphabet());
+    alphabetShared = false;
+  }
+}
+
+void
+Transducer::unshareAlphabet()
+{
+  if(alphabetShared) {
+    alphabet = std::make_shared<SymbolTable>(*alphabet);
+    alphabetShared = false;
+  }
 }
 
 std::vector<std::map<state_t, std::vector<Transition>>>&
@@ -34,30 +79,48 @@ Transducer::getTransitions()
   return transitions;
 }
 
+const std::vector<std::map<state_t, std::vector<Transition>>>&
+Transducer::getTransitions() const
+{
+  return transitions;
+}
+
 std::map<state_t, double>&
 Transducer::getFinals()
 {
   return finals;
 }
 
+const std::map<state_t, double>&
+Transducer::getFinals() const
+{
+  return finals;
+}
+
 std::map<UnicodeString, TapeInfo>&
 Transducer::getTapeInfo()
 {
   return tapeNames;
 }
 
+const std::map<UnicodeString, TapeInfo>&
+Transducer::getTapeInfo() const
+{
+  return tapeNames;
+}
+
 void
-Transducer::setTapeInfo(std::map<UnicodeString, TapeInfo> names)
+Transducer::setTapeInfo(const std::map<UnicodeString, TapeInfo>& names)
 {
   // TODO: is it more useful to have this be for adding multiple names
   // or for completely replacing the set of names?
-  for(auto it : names) {
+  for(auto& it : names) {
     setTapeInfo(it.first, it.second);
   }
 }
 
 void
-Transducer::setTapeInfo(UnicodeString name, TapeInfo info)
+Transducer::setTapeInfo(const UnicodeString& name, TapeInfo info)
 {
   if(info.index >= tapeCount) {
     throw std::invalid_argument("TapeInfo refers to non-existent index");
@@ -66,17 +129,23 @@ Transducer::setTapeInfo(UnicodeString name, TapeInfo info)
 }
 
 size_t
-Transducer::getTapeCount()
+Transducer::getTapeCount() const
 {
   return tapeCount;
 }
 
 size_t
-Transducer::size()
+Transducer::size() const
 {
   return transitions.size();
 }
 
+TransitionIterator
+Transducer::iterState(state_t state) const
+{
+  return TransitionIterator(transitions[state]);
+}
+
 state_t
 Transducer::addState()
 {
@@ -92,7 +161,7 @@ Transducer::addStates(size_t n)
 }
 
 bool
-Transducer::isFinal(state_t state)
+Transducer::isFinal(state_t state) const
 {
   return finals.find(state) != finals.end();
 }
@@ -110,7 +179,7 @@ Transducer::setNotFinal(state_t state)
 }
 
 void
-Transducer::insertTransition(state_t src, state_t trg, Transition trans)
+Transducer::insertTransition(state_t src, state_t trg, const Transition& trans)
 {
   if(trans.symbols.size() != tapeCount) {
     throw std::invalid_argument("Transition has wrong dimensions");
@@ -120,11 +189,11 @@ Transducer::insertTransition(state_t src, state_t trg, Transition trans)
 }
 
 state_t
-Transducer::insertTransition(state_t src, Transition trans, bool checkExists)
+Transducer::insertTransition(state_t src, const Transition& trans, bool checkExists)
 {
   if(checkExists) {
-    for(auto it : transitions[src]) {
-      for(auto tr : it.second) {
+    for(auto& it : transitions[src]) {
+      for(auto& tr : it.second) {
         if(tr == trans) {
           return it.first;
         }
@@ -140,7 +209,7 @@ state_t
 Transducer::insertEpsilonTransition(state_t src, bool checkExists, double weight)
 {
   Transition tr;
-  tr.symbols = std::vector<string_ref>(tapeCount, string_ref(0));
+  tr.symbols = SymbolTuple(tapeCount);
   tr.weight = weight;
   return insertTransition(src, tr, checkExists);
 }
@@ -149,7 +218,7 @@ void
 Transducer::insertEpsilonTransition(state_t src, state_t trg, double weight)
 {
   Transition tr;
-  tr.symbols = std::vector<string_ref>(tapeCount, string_ref(0));
+  tr.symbols = SymbolTuple(tapeCount);
   tr.weight = weight;
   insertTransition(src, trg, tr);
 }
@@ -159,3 +228,205 @@ Transducer::eraseTransitions(state_t src, state_t trg)
 {
   transitions[src].erase(trg);
 }
+
+void
+Transducer::trim()
+{
+  size_t n = transitions.size();
+  std::vector<size_t> in_start(n + 1, 0);
+  for(auto& st : transitions) {
+    for(auto& it : st) {
+      in_start[it.first + 1]++;
+    }
+  }
+  for(size_t i = 0; i < n; i++) {
+    in_start[i + 1] += in_start[i];
+  }
+  std::vector<state_t> in_from(in_start[n]);
+  std::vector<size_t> fill(in_start.begin(), in_start.end() - 1);
+  for(state_t src = 0; src < n; src++) {
+    for(auto& it : transitions[src]) {
+      in_from[fill[it.first]++] = src;
+    }
+  }
+
+  std::vector<bool> accessible(n, false);
+  std::vector<state_t> todo;
+  accessible[0] = true;
+  todo.push_back(0);
+  while(!todo.empty()) {
+    state_t cur = todo.back();
+    todo.pop_back();
+    for(auto& it : transitions[cur]) {
+      if(!accessible[it.first]) {
+        accessible[it.first] = true;
+        todo.push_back(it.first);
+      }
+    }
+  }
+  std::vector<bool> keep(n, false);
+  for(auto& it : finals) {
+    if(accessible[it.first]) {
+      keep[it.first] = true;
+      todo.push_back(it.first);
+    }
+  }
+  while(!todo.empty()) {
+    state_t cur = todo.back();
+    todo.pop_back();
+    for(size_t i = in_start[cur]; i < in_start[cur + 1]; i++) {
+      state_t prev = in_from[i];
+      if(accessible[prev] && !keep[prev]) {
+        keep[prev] = true;
+        todo.push_back(prev);
+      }
+    }
+  }
+  // the start state stays even if it can't reach a final state,
+  // but then none of its transitions can be on a successful path
+  bool start_live = keep[0];
+  keep[0] = true;
+
+  std::vector<state_t> renumber(n, 0);
+  state_t count = 0;
+  for(state_t state = 0; state < n; state++) {
+    if(keep[state]) {
+      renumber[state] = count++;
+    }
+  }
+  for(state_t state = 0; state < n; state++) {
+    if(!keep[state]) {
+      continue;
+    }
+    std::map<state_t, std::vector<Transition>> arcs;
+    for(auto& it : transitions[state]) {
+      if(keep[it.first] && (state != 0 || start_live)) {
+        arcs.emplace_hint(arcs.end(), renumber[it.first], std::move(it.second));
+      }
+    }
+    transitions[renumber[state]] = std::move(arcs);
+  }
+  transitions.resize(count);
+  std::map<state_t, double> new_finals;
+  for(auto& it : finals) {
+    if(keep[it.first]) {
+      new_finals[renumber[it.first]] = it.second;
+    }
+  }
+  finals = new_finals;
+}
+
+bool
+lessTransition(const std::pair<state_t, const Transition*>& x, const std::pair<state_t, const Transition*>& y)
+{
+  if(x.first != y.first) {
+    return x.first < y.first;
+  }
+  const SymbolTuple& xs = x.second->symbols;
+  const SymbolTuple& ys = y.second->symbols;
+  if(xs != ys) {
+    return std::lexicographical_compare(xs.begin(), xs.end(), ys.begin(), ys.end());
+  }
+  return x.second->weight < y.second->weight;
+}
+
+void
+Transducer::mergeEquivalentStates()
+{
+  std::vector<state_t> rep(size());
+  std::iota(rep.begin(), rep.end(), 0);
+  // the transitions of a state, with each target replaced by its
+  // representative, sorted and without duplicates
+  auto signature = [&](state_t s, std::vector<std::pair<state_t, const Transition*>>& sig) {
+    sig.clear();
+    for(auto& it : transitions[s]) {
+      for(auto& tr : it.second) {
+        sig.push_back(std::make_pair(rep[it.first], &tr));
+      }
+    }
+    std::sort(sig.begin(), sig.end(), lessTransition);
+    sig.erase(std::unique(sig.begin(), sig.end(),
+                          [](const std::pair<state_t, const Transition*>& x, const std::pair<state_t, const Transition*>& y) {
+                            return x.first == y.first && *x.second == *y.second;
+                          }), sig.end());
+  };
+  std::vector<std::pair<state_t, const Transition*>> sig;
+  std::vector<std::pair<state_t, const Transition*>> other;
+  std::unordered_map<size_t, std::vector<state_t>> groups;
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    groups.clear();
+    for(state_t s = 0; s < size(); s++) {
+      if(rep[s] != s) {
+        continue;
+      }
+      signature(s, sig);
+      auto fin = finals.find(s);
+      size_t h = (fin == finals.end() ? 0 : std::hash<double>()(fin->second) + 1);
+      for(auto& it : sig) {
+        h = h * 31 + it.first;
+        for(auto sym : it.second->symbols) {
+          h = h * 31 + sym.i;
+        }
+        h = h * 31 + std::hash<double>()(it.second->weight);
+      }
+      std::vector<state_t>& group = groups[h];
+      bool merged = false;
+      for(state_t r : group) {
+        auto rfin = finals.find(r);
+        if((fin == finals.end()) != (rfin == finals.end()) ||
+           (fin != finals.end() && fin->second != rfin->second)) {
+          continue;
+        }
+        signature(r, other);
+        if(other.size() == sig.size() &&
+           std::equal(sig.begin(), sig.end(), other.begin(),
+                      [](const std::pair<state_t, const Transition*>& x, const std::pair<state_t, const Transition*>& y) {
+                        return x.first == y.first && *x.second == *y.second;
+                      })) {
+          rep[s] = r;
+          merged = true;
+          changed = true;
+          break;
+        }
+      }
+      if(!merged) {
+        group.push_back(s);
+      }
+    }
+    for(state_t s = 0; s < size(); s++) {
+      rep[s] = rep[rep[s]];
+    }
+  }
+
+  std::vector<state_t> renumber(size());
+  state_t next = 0;
+  for(state_t s = 0; s < size(); s++) {
+    if(rep[s] == s) {
+      renumber[s] = next++;
+    }
+  }
+  std::vector<std::map<state_t, std::vector<Transition>>> merged(next);
+  std::map<state_t, double> merged_finals;
+  for(state_t s = 0; s < size(); s++) {
+    if(rep[s] != s) {
+      continue;
+    }
+    auto& out = merged[renumber[s]];
+    for(auto& it : transitions[s]) {
+      auto& arcs = out[renumber[rep[it.first]]];
+      for(auto& tr : it.second) {
+        if(std::find(arcs.begin(), arcs.end(), tr) == arcs.end()) {
+          arcs.push_back(tr);
+        }
+      }
+    }
+    auto fin = finals.find(s);
+    if(fin != finals.end()) {
+      merged_finals[renumber[s]] = fin->second;
+    }
+  }
+  transitions.swap(merged);
+  finals.swap(merged_finals);
+}
@@ -3,6 +3,7 @@
 
 #include "transition.h"
 #include "symbol_table.h"
+#include "transducer_view.h"
 
 #include <unicode/unistr.h>
 #include <unicode/ustdio.h>
@@ -10,22 +11,11 @@
 #include <map>
 #include <vector>
 
-typedef size_t state_t;
-
-enum TapeInfoFlags {
-  SymbolTape = 1,
-  FlagTape   = 2
-};
-
-struct TapeInfo {
-  size_t index;
-  unsigned int flags;
-};
-
-class Transducer {
+class Transducer : public TransducerView {
 private:
   size_t tapeCount;
-  SymbolTable alphabet;
+  std::shared_ptr<SymbolTable> alphabet;
+  bool alphabetShared;
   std::vector<std::map<state_t, std::vector<Transition>>> transitions;
   std::map<state_t, double> finals;
   std::map<UnicodeString, TapeInfo> tapeNames;
@@ -33,36 +23,59 @@ public:
   Transducer(size_t tapes);
   ~Transducer();
 
-  Transducer* emptyCopy();
-
   SymbolTable& getAlphabet();
+  const SymbolTable& getAlphabet() const override;
+  std::shared_ptr<SymbolTable> getSharedAlphabet() const override;
+  // Use alpha, which other transducers may also be using, as the
+  // alphabet. Symbols may be added to it but never changed.
+  void shareAlphabet(std::shared_ptr<SymbolTable> alpha);
+  // share the alphabet of other if it is shared, otherwise copy it
+  void copyAlphabet(const TransducerView* other);
+  // stop sharing the alphabet and keep a copy of it instead
+  void unshareAlphabet();
   std::vector<std::map<state_t, std::vector<Transition>>>& getTransitions();
+  const std::vector<std::map<state_t, std::vector<Transition>>>& getTransitions() const;
   std::map<state_t, double>& getFinals();
+  const std::map<state_t, double>& getFinals() const override;
   std::map<UnicodeString, TapeInfo>& getTapeInfo();
-  void setTapeInfo(std::map<UnicodeString, TapeInfo> names);
-  void setTapeInfo(UnicodeString name, TapeInfo info);
-  size_t getTapeCount();
-  size_t size();
+  const std::map<UnicodeString, TapeInfo>& getTapeInfo() const override;
+  void setTapeInfo(const std::map<UnicodeString, TapeInfo>& names);
+  void setTapeInfo(const UnicodeString& name, TapeInfo info);
+  size_t getTapeCount() const override;
+  size_t size() const override;
+  TransitionIterator iterState(state_t state) const override;
 
   state_t addState();
   void addStates(size_t n);
-  bool isFinal(state_t state);
+  bool isFinal(state_t state) const override;
   void setFinal(state_t state, double weight = 0.000);
   void setNotFinal(state_t state);
 
   // insert trans connecting src to trg
-  void insertTransition(state_t src, state_t trg, Transition trans);
+  void insertTransition(state_t src, state_t trg, const Transition& trans);
   // create a new state and connect it to src with trans
   // if checkExists = true and there is already an equivalent transition
   // from src, return that transition's destination
   // returns new state
-  state_t insertTransition(state_t src, Transition trans, bool checkExists = false);
+  state_t insertTransition(state_t src, const Transition& trans, bool checkExists = false);
   // TODO: shortcuts for adding common types of transitions
   // including checking if the transition already exists
   state_t insertEpsilonTransition(state_t src, bool checkExists = false, double weight = 0.000);
   void insertEpsilonTransition(state_t src, state_t trg, double weight = 0.000);
 
   void eraseTransitions(state_t src, state_t trg);
+
+  // Remove, in place, every state which is unreachable from state 0
+  // or from which no final state can be reached.
+  // The remaining states keep their relative order.
+  void trim();
+  // Merge states which are known to be equivalent because they have the
+  // same finality and the same transitions to states known to be
+  // equivalent, repeating until nothing more can be merged.
+  // This merges common suffixes, though unlike full minimization it
+  // doesn't merge states whose loops are merely equivalent.
+  // The remaining states keep their relative order.
+  void mergeEquivalentStates();
 };
 
 #endif
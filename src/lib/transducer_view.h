@@ -0,0 +1,50 @@
+#ifndef _LIB_TRANSDUCER_VIEW_H_
+#define _LIB_TRANSDUCER_VIEW_H_
+
+#include "transition.h"
+#include "symbol_table.h"
+#include "utils/transition_iter.h"
+
+#include <unicode/unistr.h>
+#include <map>
+#include <memory>
+
+class Transducer;
+
+enum TapeInfoFlags {
+  SymbolTape = 1,
+  FlagTape   = 2
+};
+
+struct TapeInfo {
+  size_t index;
+  unsigned int flags;
+};
+
+// Read-only access to a transducer, independent of how it is stored.
+// Algorithms which only read their input take a const TransducerView*
+// so that they can be applied to any representation without copying it.
+class TransducerView {
+public:
+  virtual ~TransducerView() {}
+
+  virtual const SymbolTable& getAlphabet() const = 0;
+  virtual const std::map<state_t, double>& getFinals() const = 0;
+  virtual const std::map<UnicodeString, TapeInfo>& getTapeInfo() const = 0;
+  virtual size_t getTapeCount() const = 0;
+  virtual size_t size() const = 0;
+  virtual bool isFinal(state_t state) const = 0;
+  virtual TransitionIterator iterState(state_t state) const = 0;
+  // the alphabet if it is the shared one (see sharedAlphabet()),
+  // or NULL if this transducer has its own
+  virtual std::shared_ptr<SymbolTable> getSharedAlphabet() const { return nullptr; }
+  // whether states are only computed as they are visited,
+  // so that reading all of them may cost as much as building them
+  virtual bool isLazy() const { return false; }
+
+  // create a Transducer with the same alphabet and tapes
+  // but only a single state
+  Transducer* emptyCopy() const;
+};
+
+#endif
@@ -1,15 +1,112 @@
 #include "transition.h"
+#include <algorithm>
 
-bool
-operator==(const Transition& a, const Transition& b)
+void
+SymbolTuple::allocate(size_t n)
 {
-  if(a.symbols.size() != b.symbols.size() || a.weight != b.weight) {
-    return false;
+  count = (unsigned int)n;
+  if(isInline()) {
+    std::fill(store.local, store.local + INLINE_TAPES, string_ref(0));
+  } else {
+    store.heap = new string_ref[n];
   }
-  for(size_t i = 0; i < a.symbols.size(); i++) {
-    if(a.symbols[i] != b.symbols[i]) {
-      return false;
-    }
+}
+
+void
+SymbolTuple::release()
+{
+  if(!isInline()) {
+    delete[] store.heap;
   }
-  return true;
+  count = 0;
+}
+
+SymbolTuple::SymbolTuple()
+{
+  allocate(0);
+}
+
+SymbolTuple::SymbolTuple(size_t n, string_ref fill)
+{
+  allocate(n);
+  std::fill(begin(), end(), fill);
+}
+
+SymbolTuple::SymbolTuple(const SymbolTuple& other)
+{
+  allocate(other.count);
+  std::copy(other.begin(), other.end(), begin());
+}
+
+SymbolTuple::SymbolTuple(SymbolTuple&& other) noexcept
+{
+  count = other.count;
+  store = other.store;
+  other.count = 0;
+}
+
+SymbolTuple::~SymbolTuple()
+{
+  release();
+}
+
+SymbolTuple&
+SymbolTuple::operator=(const SymbolTuple& other)
+{
+  if(this != &other) {
+    assign(other.begin(), other.end());
+  }
+  return *this;
+}
+
+SymbolTuple&
+SymbolTuple::operator=(SymbolTuple&& other) noexcept
+{
+  if(this != &other) {
+    release();
+    count = other.count;
+    store = other.store;
+    other.count = 0;
+  }
+  return *this;
+}
+
+void
+SymbolTuple::resize(size_t n)
+{
+  if(n == count) {
+    return;
+  }
+  SymbolTuple next(n);
+  std::copy(begin(), begin() + std::min(n, size()), next.begin());
+  *this = std::move(next);
+}
+
+void
+SymbolTuple::assign(const string_ref* first, const string_ref* last)
+{
+  size_t n = (size_t)(last - first);
+  if(n != count) {
+    release();
+    allocate(n);
+  }
+  std::copy(first, last, begin());
+}
+
+bool
+operator==(const SymbolTuple& a, const SymbolTuple& b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+bool
+operator!=(const SymbolTuple& a, const SymbolTuple& b)
+{
+  return !(a == b);
+}
+
+bool
+operator==(const Transition& a, const Transition& b)
+{
+  return a.weight == b.weight && a.symbols == b.symbols;
 }
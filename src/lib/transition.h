@@ -1,14 +1,91 @@
 #ifndef _LIB_TRANSITION_H_
 #define _LIB_TRANSITION_H_
 
-#include <vector>
+#include <cstddef>
 #include "symbol_table.h"
 
+// The symbols of a transition, one per tape.
+// Transducers with at most INLINE_TAPES tapes store their symbols
+// inside the object, so creating or copying a Transition doesn't
+// allocate. Larger tuples fall back to a heap array.
+class SymbolTuple {
+public:
+  static constexpr size_t INLINE_TAPES = 4;
+private:
+  unsigned int count;
+  union Storage {
+    string_ref local[INLINE_TAPES];
+    string_ref* heap;
+    Storage() : local() {}
+  } store;
+
+  bool isInline() const { return count <= INLINE_TAPES; }
+  void allocate(size_t n);
+  void release();
+public:
+  SymbolTuple();
+  explicit SymbolTuple(size_t n, string_ref fill = string_ref(0));
+  SymbolTuple(const SymbolTuple& other);
+  SymbolTuple(SymbolTuple&& other) noexcept;
+  ~SymbolTuple();
+
+  SymbolTuple& operator=(const SymbolTuple& other);
+  SymbolTuple& operator=(SymbolTuple&& other) noexcept;
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  string_ref* data() { return isInline() ? store.local : store.heap; }
+  const string_ref* data() const { return isInline() ? store.local : store.heap; }
+  string_ref& operator[](size_t i) { return data()[i]; }
+  const string_ref& operator[](size_t i) const { return data()[i]; }
+  string_ref* begin() { return data(); }
+  string_ref* end() { return data() + count; }
+  const string_ref* begin() const { return data(); }
+  const string_ref* end() const { return data() + count; }
+
+  // new entries are epsilon
+  void resize(size_t n);
+  void assign(const string_ref* first, const string_ref* last);
+};
+
+bool operator==(const SymbolTuple& a, const SymbolTuple& b);
+bool operator!=(const SymbolTuple& a, const SymbolTuple& b);
+
+typedef size_t state_t;
+
 struct Transition {
-  std::vector<string_ref> symbols;
-  double weight;
+  SymbolTuple symbols;
+  double weight = 0.000;
 };
 
 bool operator==(const Transition& a, const Transition& b);
 
+// Read-only view of the symbols of a transition wherever they are stored.
+class SymbolSpan {
+private:
+  const string_ref* first;
+  size_t count;
+public:
+  SymbolSpan(const string_ref* syms, size_t n) : first(syms), count(n) {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const string_ref* data() const { return first; }
+  const string_ref& operator[](size_t i) const { return first[i]; }
+  const string_ref* begin() const { return first; }
+  const string_ref* end() const { return first + count; }
+};
+
+// A Transition which is not copied out of the Transducer or
+// FrozenTransducer holding it, so it is only valid as long as they are.
+struct TransitionView {
+  SymbolSpan symbols;
+  double weight;
+
+  TransitionView(const Transition& tr) :
+    symbols(tr.symbols.data(), tr.symbols.size()), weight(tr.weight) {}
+  TransitionView(const string_ref* syms, size_t tapes, double w) :
+    symbols(syms, tapes), weight(w) {}
+};
+
 #endif
@@ -69,7 +69,8 @@ using namespace std;
 constexpr char HEADER_TRANSDUCER[4]{'F', 'S', 'N', 'T'};
 enum TD_FEATURES : uint64_t {
   TDF_WEIGHTS = (1ull << 0),
-  TDF_UNKNOWN = (1ull << 1), // Features >= this are unknown, so throw an error; Inc this if more features are added
+  TDF_SHARED_ALPHABET = (1ull << 1), // The alphabet is a shared symbol registry
+  TDF_UNKNOWN = (1ull << 2), // Features >= this are unknown, so throw an error; Inc this if more features are added
   TDF_RESERVED = (1ull << 63), // If we ever reach this many feature flags, we need a flag to know how to extend beyond 64 bits
 };
 
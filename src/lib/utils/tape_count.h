@@ -0,0 +1,37 @@
+#ifndef _UTIL_TAPE_COUNT_H_
+#define _UTIL_TAPE_COUNT_H_
+
+#include <cstddef>
+
+// Loop bounds for loops over the tapes of a transition.
+// Code templated on one of these writes
+//   for(size_t i = 0; i < Tapes::count(n); i++)
+// and for StaticTapes the bound is a compile-time constant,
+// so the loop can be unrolled and vectorized.
+
+template<size_t N>
+struct StaticTapes {
+  static constexpr size_t count(size_t) { return N; }
+};
+
+struct DynamicTapes {
+  static constexpr size_t count(size_t n) { return n; }
+};
+
+constexpr size_t MAX_STATIC_TAPES = 4;
+
+// call f(StaticTapes<n>()) if n <= MAX_STATIC_TAPES
+// and f(DynamicTapes()) otherwise
+template<typename F>
+auto dispatchTapes(size_t n, F f)
+{
+  switch(n) {
+    case 1: return f(StaticTapes<1>());
+    case 2: return f(StaticTapes<2>());
+    case 3: return f(StaticTapes<3>());
+    case 4: return f(StaticTapes<4>());
+    default: return f(DynamicTapes());
+  }
+}
+
+#endif
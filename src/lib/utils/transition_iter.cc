@@ -1,48 +1,128 @@
 #include "transition_iter.h"
+#include "../frozen_transducer.h"
+#include "../transducer_view.h"
 
-TransitionIterator::TransitionIterator(const std::map<state_t, std::vector<Transition>>& tr)
+TransitionIterator::TransitionIterator(const std::map<state_t, std::vector<Transition>>& tr) :
+  transitions(&tr), mit(tr.begin()), vidx(0), frozen(nullptr),
+  arc(0), arc_begin(0), arc_end(0)
 {
-  transitions = &tr;
-  mit = (*transitions).begin();
-  vit = (*mit).second.begin();
-  cur = std::make_pair((*mit).first, *vit);
+  skipEmpty();
+  update();
+}
+
+TransitionIterator::TransitionIterator(std::shared_ptr<const std::map<state_t, std::vector<Transition>>> tr) :
+  transitions(tr.get()), owned(tr), mit(tr->begin()), vidx(0), frozen(nullptr),
+  arc(0), arc_begin(0), arc_end(0)
+{
+  skipEmpty();
+  update();
+}
+
+TransitionIterator::TransitionIterator(const FrozenTransducer* t, size_t begin, size_t end) :
+  transitions(nullptr), vidx(0), frozen(t),
+  arc(begin), arc_begin(begin), arc_end(end)
+{
+  update();
 }
 
 TransitionIterator::TransitionIterator(const TransitionIterator& other)
 {
   transitions = other.transitions;
+  owned = other.owned;
   mit = other.mit;
-  vit = other.vit;
-  cur = other.cur;
+  vidx = other.vidx;
+  frozen = other.frozen;
+  arc = other.arc;
+  arc_begin = other.arc_begin;
+  arc_end = other.arc_end;
+  // cur is filled in again if needed, so that end() is cheap
+  current = false;
 }
 
 TransitionIterator::~TransitionIterator()
 {
 }
 
+bool
+TransitionIterator::atEnd() const
+{
+  if(frozen) {
+    return arc >= arc_end;
+  } else {
+    return mit == transitions->end();
+  }
+}
+
+void
+TransitionIterator::skipEmpty()
+{
+  while(!frozen && mit != transitions->end() && vidx >= mit->second.size()) {
+    mit++;
+    vidx = 0;
+  }
+}
+
+void
+TransitionIterator::update()
+{
+  current = false;
+}
+
 const std::pair<state_t, Transition>&
 TransitionIterator::operator*() const
 {
+  if(!current) {
+    cur.first = target();
+    TransitionView tr = transition();
+    cur.second.symbols.assign(tr.symbols.begin(), tr.symbols.end());
+    cur.second.weight = tr.weight;
+    current = true;
+  }
   return cur;
 }
 
+const std::pair<state_t, Transition>*
+TransitionIterator::operator->() const
+{
+  return &(**this);
+}
+
+state_t
+TransitionIterator::target() const
+{
+  if(frozen) {
+    return frozen->arc(arc).target;
+  }
+  return mit->first;
+}
+
+TransitionView
+TransitionIterator::transition() const
+{
+  if(frozen) {
+    return TransitionView(frozen->arcSymbols(arc), frozen->getTapeCount(), frozen->arc(arc).weight);
+  }
+  return TransitionView(mit->second[vidx]);
+}
+
 TransitionIterator
 TransitionIterator::operator++(int)
 {
   TransitionIterator other = TransitionIterator(*this);
-  other++;
+  ++(*this);
   return other;
 }
 
 TransitionIterator&
 TransitionIterator::operator++()
 {
-  vit++;
-  if(vit == (*mit).second.end()) {
-    mit++;
-    vit = (*mit).second.begin();
+  if(frozen) {
+    arc++;
+  } else {
+    vidx++;
+    skipEmpty();
   }
-  cur = std::make_pair((*mit).first, *vit);
+  update();
   return *this;
 }
 
@@ -50,54 +130,68 @@ TransitionIterator
 TransitionIterator::operator--(int)
 {
   TransitionIterator other = TransitionIterator(*this);
-  other--;
+  --(*this);
   return other;
 }
 
 TransitionIterator&
 TransitionIterator::operator--()
 {
-  if(vit == (*mit).second.begin()) {
-    mit--;
-    vit = (*mit).second.end();
+  if(frozen) {
+    arc--;
+  } else {
+    while(vidx == 0) {
+      mit--;
+      vidx = mit->second.size();
+    }
+    vidx--;
   }
-  vit--;
-  std::make_pair((*mit).first, *vit);
+  update();
   return *this;
 }
 
 bool
-TransitionIterator::operator==(TransitionIterator& other) const
+TransitionIterator::operator==(const TransitionIterator& other) const
 {
+  if(frozen || other.frozen) {
+    return frozen == other.frozen && arc == other.arc;
+  }
   return (transitions == other.transitions &&
-          mit == other.mit && vit == other.vit);
+          mit == other.mit && vidx == other.vidx);
 }
 
 bool
-TransitionIterator::operator!=(TransitionIterator& other) const
+TransitionIterator::operator!=(const TransitionIterator& other) const
 {
-  return (transitions != other.transitions ||
-          mit != other.mit || vit != other.vit);
+  return !(*this == other);
 }
 
 TransitionIterator
-TransitionIterator::begin()
+TransitionIterator::begin() const
 {
+  if(frozen) {
+    return TransitionIterator(frozen, arc_begin, arc_end);
+  } else if(owned) {
+    return TransitionIterator(owned);
+  }
   return TransitionIterator(*transitions);
 }
 
 TransitionIterator
-TransitionIterator::end()
+TransitionIterator::end() const
 {
-  TransitionIterator ret = TransitionIterator(*transitions);
-  ret.mit = (*transitions).end();
-  ret.vit = (*mit).second.end();
-  ret.cur = std::make_pair((*mit).first, *vit);
+  TransitionIterator ret = TransitionIterator(*this);
+  if(frozen) {
+    ret.arc = arc_end;
+  } else {
+    ret.mit = transitions->end();
+    ret.vidx = 0;
+  }
   return ret;
 }
 
 TransitionIterator
-iter_state(Transducer* t, state_t s)
+iter_state(const TransducerView* t, state_t s)
 {
-  return TransitionIterator(t->getTransitions()[s]);
+  return t->iterState(s);
 }
@@ -1,31 +1,60 @@
 #ifndef _UTIL_TRANSITION_ITER_H_
 #define _UTIL_TRANSITION_ITER_H_
 
-#include "../transducer.h"
+#include "../transition.h"
+#include <map>
+#include <memory>
+#include <vector>
 
+class FrozenTransducer;
+class TransducerView;
+
+// Iterates over the transitions leaving a single state,
+// yielding (target, transition) pairs.
+// Works on both the map-based storage of Transducer
+// and the arc arrays of FrozenTransducer.
+// An iterator may also share ownership of the map it walks, for views
+// such as LazyComposition which might discard their copy at any time.
 class TransitionIterator {
 private:
   const std::map<state_t, std::vector<Transition>>* transitions;
+  std::shared_ptr<const std::map<state_t, std::vector<Transition>>> owned;
   std::map<state_t, std::vector<Transition>>::const_iterator mit;
-  std::vector<Transition>::const_iterator vit;
-  std::pair<state_t, Transition> cur;
+  size_t vidx;
+  const FrozenTransducer* frozen;
+  size_t arc;
+  size_t arc_begin;
+  size_t arc_end;
+  // only filled in by operator* and operator->
+  mutable std::pair<state_t, Transition> cur;
+  mutable bool current;
+
+  bool atEnd() const;
+  void skipEmpty();
+  void update();
 public:
   TransitionIterator(const std::map<state_t, std::vector<Transition>>& tr);
+  TransitionIterator(std::shared_ptr<const std::map<state_t, std::vector<Transition>>> tr);
+  TransitionIterator(const FrozenTransducer* t, size_t begin, size_t end);
   TransitionIterator(const TransitionIterator& other);
   ~TransitionIterator();
 
+  // These copy the transition, which target() and transition() avoid.
   const std::pair<state_t, Transition>& operator*() const;
+  const std::pair<state_t, Transition>* operator->() const;
+  state_t target() const;
+  TransitionView transition() const;
   TransitionIterator operator++(int);
   TransitionIterator& operator++();
   TransitionIterator operator--(int);
   TransitionIterator& operator--();
-  bool operator==(TransitionIterator& other) const;
-  bool operator!=(TransitionIterator& other) const;
+  bool operator==(const TransitionIterator& other) const;
+  bool operator!=(const TransitionIterator& other) const;
 
-  TransitionIterator begin();
-  TransitionIterator end();
+  TransitionIterator begin() const;
+  TransitionIterator end() const;
 };
 
-TransitionIterator iter_state(Transducer* t, state_t s);
+TransitionIterator iter_state(const TransducerView* t, state_t s);
 
 #endif
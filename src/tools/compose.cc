@@ -1,6 +1,7 @@
 #include "lib/transducer.h"
 #include "lib/io.h"
 #include "lib/compose.h"
+#include "lib/lazy_composition.h"
 #include <unicode/ustdio.h>
 #include <libgen.h>
 #include <getopt.h>
@@ -12,15 +13,63 @@ void endProgram(char *name)
 {
   if(name != NULL)
   {
-    cout << basename(name) << ": compose 2 transducers" << endl;
-    cout << "USAGE: " << basename(name) << " transducer transducer (-g tape tape)* [output_file]" << endl;
+    cout << basename(name) << ": compose 2 or more transducers" << endl;
+    cout << "USAGE: " << basename(name) << " transducer transducer (-g tape tape)* (-t transducer (-g tape tape)*)* [-f filter] [-j threads] [-T] [-w weight] [-s dir [-S states]] [-N states] [-A arcs] [-B symbols] [-M megabytes] [-J join] [-P] [-k tape]* [-F] [output_file]" << endl;
+    cout << "  -t composes the result so far with another transducer, along the -g tapes which follow it" << endl;
+    cout << "  -f removes redundant epsilon paths: none (default), sequence, or match" << endl;
+    cout << "  -T removes states which cannot reach a final state" << endl;
+    cout << "  -w only keeps paths at most this much heavier than the lightest path" << endl;
+    cout << "  -s keeps the composition on disk in temporary files in this directory" << endl;
+    cout << "  -S the number of states to keep in memory with -s (default 4194304)" << endl;
+    cout << "  -N, -A, -B, -M give up if the result has more states or transitions, if a backlog" << endl;
+    cout << "     holds more symbols, or if more memory is used than this (with -t, in any one step)" << endl;
+    cout << "  -J matches transitions by: auto (default), nested, indexed, or merge" << endl;
+    cout << "  -P reports statistics about the inputs and which joins were used" << endl;
+    cout << "  -k only keeps this tape in the result (may be repeated)" << endl;
+    cout << "  -F leaves out paths which are blocked by flag diacritics" << endl;
   }
   exit(EXIT_FAILURE);
 }
 
+void reportOperand(const char* side, const OperandStats& stats)
+{
+  cerr << side << ": " << stats.states << " states, " << stats.arcs << " transitions, ";
+  cerr << "fan-out " << (stats.states == 0 ? 0 : (double)stats.arcs / (double)stats.states);
+  cerr << " average, " << stats.max_fanout << " max, ";
+  cerr << (stats.deterministic ? "deterministic" : "nondeterministic");
+  cerr << (stats.sorted ? " and sorted" : " and unsorted") << " on the composing tape" << endl;
+  cerr << "  epsilons per tape:";
+  for(auto it : stats.epsilon_density) {
+    cerr << " " << it;
+  }
+  cerr << endl;
+}
+
+void reportPlan(const ComposePlan& plan)
+{
+  reportOperand("left", plan.left);
+  reportOperand("right", plan.right);
+  cerr << "states expanded with nested loop join: " << plan.nested;
+  cerr << ", indexed join: " << plan.indexed;
+  cerr << ", merge join: " << plan.merged << endl;
+}
+
 int main(int argc, char *argv[])
 {
-  vector<pair<UnicodeString, UnicodeString>> glue;
+  vector<vector<pair<UnicodeString, UnicodeString>>> glue(1);
+  vector<string> then_files;
+  size_t threads = 1;
+  ComposeFilter filter = TrivialFilter;
+  bool trim = false;
+  bool prune = false;
+  double threshold = 0;
+  string spill_dir;
+  size_t memory_states = 1 << 22;
+  ComposeLimits limits;
+  ComposeJoin join = AutoJoin;
+  bool report = false;
+  vector<UnicodeString> keep;
+  bool flags = false;
 
   #if HAVE_GETOPT_LONG
   int option_index=0;
@@ -31,13 +80,28 @@ int main(int argc, char *argv[])
     static struct option long_options[] =
     {
       {"glue",      required_argument, 0, 'g'},
+      {"then",      required_argument, 0, 't'},
+      {"filter",    required_argument, 0, 'f'},
+      {"trim",      no_argument,       0, 'T'},
+      {"weight",    required_argument, 0, 'w'},
+      {"threads",   required_argument, 0, 'j'},
+      {"spill",     required_argument, 0, 's'},
+      {"spill-states", required_argument, 0, 'S'},
+      {"max-states",  required_argument, 0, 'N'},
+      {"max-arcs",    required_argument, 0, 'A'},
+      {"max-backlog", required_argument, 0, 'B'},
+      {"max-memory",  required_argument, 0, 'M'},
+      {"join",        required_argument, 0, 'J'},
+      {"plan",        no_argument,       0, 'P'},
+      {"keep",        required_argument, 0, 'k'},
+      {"flags",       no_argument,       0, 'F'},
       {"help",      no_argument,       0, 'h'},
       {0, 0, 0, 0}
     };
 
-    int cnt=getopt_long(argc, argv, "g:h", long_options, &option_index);
+    int cnt=getopt_long(argc, argv, "g:t:f:j:Tw:s:S:N:A:B:M:J:Pk:Fh", long_options, &option_index);
 #else
-    int cnt=getopt(argc, argv, "g:h");
+    int cnt=getopt(argc, argv, "g:t:f:j:Tw:s:S:N:A:B:M:J:Pk:Fh");
 #endif
     if (cnt==-1)
       break;
@@ -53,10 +117,112 @@ int main(int argc, char *argv[])
           exit(EXIT_FAILURE);
         }
         UnicodeString r = argv[optind-1];
-        glue.push_back(make_pair(l, r));
+        glue.back().push_back(make_pair(l, r));
+      }
+        break;
+
+      case 't':
+        then_files.push_back(optarg);
+        glue.push_back(vector<pair<UnicodeString, UnicodeString>>());
+        break;
+
+      case 'f':
+      {
+        string name = optarg;
+        if(name == "none") {
+          filter = TrivialFilter;
+        } else if(name == "sequence") {
+          filter = SequenceFilter;
+        } else if(name == "match") {
+          filter = MatchFilter;
+        } else {
+          cout << "Unknown filter '" << name << "'" << endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+        break;
+
+      case 'T':
+        trim = true;
+        break;
+
+      case 'w':
+        prune = true;
+        threshold = atof(optarg);
+        break;
+
+      case 'j':
+      {
+        int n = atoi(optarg);
+        if(n < 1) {
+          cout << "Number of threads must be at least 1" << endl;
+          exit(EXIT_FAILURE);
+        }
+        threads = (size_t)n;
+      }
+        break;
+
+      case 's':
+        spill_dir = optarg;
+        break;
+
+      case 'S':
+      {
+        long n = atol(optarg);
+        if(n < 1) {
+          cout << "Number of states in memory must be at least 1" << endl;
+          exit(EXIT_FAILURE);
+        }
+        memory_states = (size_t)n;
+      }
+        break;
+
+      case 'N':
+        limits.states = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'A':
+        limits.arcs = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'B':
+        limits.backlog = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'M':
+        limits.memory = strtoul(optarg, NULL, 10) * 1024 * 1024;
+        break;
+
+      case 'J':
+      {
+        string name = optarg;
+        if(name == "auto") {
+          join = AutoJoin;
+        } else if(name == "nested") {
+          join = NestedLoopJoin;
+        } else if(name == "indexed") {
+          join = IndexedJoin;
+        } else if(name == "merge") {
+          join = MergeJoin;
+        } else {
+          cout << "Unknown join '" << name << "'" << endl;
+          exit(EXIT_FAILURE);
+        }
       }
         break;
 
+      case 'P':
+        report = true;
+        break;
+
+      case 'k':
+        keep.push_back(UnicodeString(optarg));
+        break;
+
+      case 'F':
+        flags = true;
+        break;
+
       case 'h': // fallthrough
       default:
         endProgram(argv[0]);
@@ -64,14 +230,89 @@ int main(int argc, char *argv[])
     }
   }
 
+  if(threads > 1 && !then_files.empty()) {
+    cout << "Cannot use multiple threads when composing more than 2 transducers" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(prune && (threads > 1 || !then_files.empty())) {
+    cout << "Cannot prune by weight when using multiple threads or composing more than 2 transducers" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if((join != AutoJoin || report || flags) && !then_files.empty()) {
+    cout << "Cannot use -J, -P or -F when composing more than 2 transducers" << endl;
+    exit(EXIT_FAILURE);
+  }
+  if(!spill_dir.empty() && (threads > 1 || !then_files.empty() || prune || trim)) {
+    cout << "Cannot use -s with -j, -t, -w or -T" << endl;
+    exit(EXIT_FAILURE);
+  }
+
   #include "tools/cli/get_io_2fsts.cc"
 
-  Transducer* t1 = readBin(input1);
-  Transducer* t2 = readBin(input2);
+  FrozenTransducer* t1 = readFrozenBin(input1);
+  FrozenTransducer* t2 = readFrozenBin(input2);
+  vector<const TransducerView*> stages = {t1, t2};
+  vector<FrozenTransducer*> rest;
+  for(auto& fname : then_files) {
+    FILE* in = fopen(fname.c_str(), "rb");
+    if(!in) {
+      std::cerr << "Error: Cannot open file '" << fname << "' for reading." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    rest.push_back(readFrozenBin(in));
+    stages.push_back(rest.back());
+    fclose(in);
+  }
 
-  Transducer* t = compose(t1, t2, glue, false);
+  Transducer* t = NULL;
+  try {
+    if(rest.empty()) {
+      unifyAlphabets({t1, t2});
+      Composer comp(t1, t2, glue[0], false, filter);
+      comp.setLimits(limits);
+      comp.setJoin(join);
+      if(!keep.empty()) {
+        comp.keepTapes(keep);
+      }
+      if(flags) {
+        comp.evaluateFlags();
+      }
+      if(!spill_dir.empty()) {
+        comp.composeToFile(output, spill_dir, memory_states);
+      } else if(prune) {
+        t = comp.composePruned(threshold);
+      } else {
+        t = comp.compose(threads);
+      }
+      if(report) {
+        reportPlan(comp.getPlan());
+      }
+    } else {
+      vector<FrozenTransducer*> all = {t1, t2};
+      all.insert(all.end(), rest.begin(), rest.end());
+      unifyAlphabets(all);
+      t = composeCascade(stages, glue, false, filter, 4096, keep, limits);
+    }
+  } catch(const std::exception& e) {
+    if(dynamic_cast<const ComposeLimitError*>(&e) == NULL) {
+      cerr << "Error: ";
+    }
+    cerr << e.what() << endl;
+    // don't leave an empty or partly written transducer behind
+    if(output != stdout) {
+      fclose(output);
+      remove(argv[argc-1]);
+    }
+    exit(EXIT_FAILURE);
+  }
+  if(trim) {
+    t->trim();
+  }
 
-  writeBin(t, output);
+  if(t) {
+    writeBin(t, output);
+  }
 
   if(input1 != stdin) {
     fclose(input1);
@@ -84,6 +325,9 @@ int main(int argc, char *argv[])
   }
   delete t1;
   delete t2;
+  for(auto it : rest) {
+    delete it;
+  }
   delete t;
   return 0;
 }
@@ -27,7 +27,7 @@ struct WalkerState {
   map<state_t, size_t> cycle_count;
 };
 
-void print(WalkerState& w, Transducer* t, UFILE* out)
+void print(WalkerState& w, const TransducerView* t, UFILE* out)
 {
   for(size_t i = 0; i < w.paths.size(); i++) {
     if(i != 0) {
@@ -40,7 +40,7 @@ void print(WalkerState& w, Transducer* t, UFILE* out)
   u_fprintf(out, "\n");
 }
 
-void expand(Transducer* t, UFILE* out, size_t max_cycles)
+void expand(const TransducerView* t, UFILE* out, size_t max_cycles)
 {
   stack<WalkerState> todo;
   WalkerState first;
@@ -48,26 +48,25 @@ void expand(Transducer* t, UFILE* out, size_t max_cycles)
   first.paths.resize(t->getTapeCount());
   first.cycle_count[0] = 1;
   todo.push(first);
-  auto trans = t->getTransitions();
   while(todo.size() > 0) {
     WalkerState cur = todo.top();
     todo.pop();
     if(t->isFinal(cur.state)) {
       print(cur, t, out);
     }
-    for(auto it : trans[cur.state]) {
-      for(auto tr : it.second) {
-        WalkerState next = cur;
-        next.state = it.first;
-        next.cycle_count[it.first] += 1;
-        if(next.cycle_count[it.first] > max_cycles+1) {
-          continue;
-        }
-        for(size_t i = 0; i < next.paths.size(); i++) {
-          next.paths[i].push_back(tr.symbols[i]);
-        }
-        todo.push(next);
+    for(auto it = t->iterState(cur.state); it != it.end(); ++it) {
+      state_t trg = it->first;
+      const SymbolTuple& syms = it->second.symbols;
+      WalkerState next = cur;
+      next.state = trg;
+      next.cycle_count[trg] += 1;
+      if(next.cycle_count[trg] > max_cycles+1) {
+        continue;
       }
+      for(size_t i = 0; i < next.paths.size(); i++) {
+        next.paths[i].push_back(syms[i]);
+      }
+      todo.push(next);
     }
   }
 }
@@ -111,7 +110,7 @@ int main(int argc, char *argv[])
 
   #include "tools/cli/get_io_fst2txt.cc"
 
-  Transducer* t = readBin(input);
+  FrozenTransducer* t = readFrozenBin(input);
 
   expand(t, output, max_cycles);
 
@@ -49,7 +49,7 @@ int main(int argc, char *argv[])
 
   #include "tools/cli/get_io_fst2txt.cc"
 
-  Transducer* t = readBin(input);
+  FrozenTransducer* t = readFrozenBin(input);
 
   writeATT(t, output, true, true);
 
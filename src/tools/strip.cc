@@ -50,7 +50,7 @@ int main(int argc, char *argv[])
 
   #include "tools/cli/get_io_fst2fst.cc"
 
-  Transducer* t = readBin(input);
+  FrozenTransducer* t = readFrozenBin(input);
 
   Transducer* rev = strip(t);
 
@@ -0,0 +1,59 @@
+#include "lib/transducer.h"
+#include "lib/io.h"
+#include "lib/compose.h"
+#include <libgen.h>
+#include <iostream>
+
+using namespace std;
+
+// Compose left_before with right, then update the result to the
+// composition of left_after with right by recompose(), so that the tests
+// can compare it with composing left_after from scratch.
+
+FrozenTransducer* readFile(const char* fname)
+{
+  FILE* in = fopen(fname, "rb");
+  if(!in) {
+    std::cerr << "Error: Cannot open file '" << fname << "' for reading." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  FrozenTransducer* t = readFrozenBin(in);
+  fclose(in);
+  return t;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc < 7) {
+    cout << "USAGE: " << basename(argv[0]) << " left_before left_after right left_tape right_tape output_file [changed_state]*" << endl;
+    exit(EXIT_FAILURE);
+  }
+  FrozenTransducer* before = readFile(argv[1]);
+  FrozenTransducer* after = readFile(argv[2]);
+  FrozenTransducer* right = readFile(argv[3]);
+  unifyAlphabets({before, after, right});
+  vector<pair<UnicodeString, UnicodeString>> tapes = {make_pair(UnicodeString(argv[4]), UnicodeString(argv[5]))};
+  set<state_t> changed;
+  for(int i = 7; i < argc; i++) {
+    changed.insert((state_t)atol(argv[i]));
+  }
+
+  ComposeProvenance provenance;
+  Transducer* previous = composeWithProvenance(before, right, tapes, provenance);
+  Transducer* t = recompose(after, right, tapes, previous, provenance, changed);
+  t->trim();
+
+  FILE* output = fopen(argv[6], "wb");
+  if(!output) {
+    std::cerr << "Error: Cannot open file '" << argv[6] << "' for writing." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  writeBin(t, output);
+  fclose(output);
+  delete before;
+  delete after;
+  delete right;
+  delete previous;
+  delete t;
+  return 0;
+}
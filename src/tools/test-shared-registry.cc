@@ -0,0 +1,47 @@
+#include "lib/transducer.h"
+#include "lib/io.h"
+#include "lib/compose.h"
+#include <libgen.h>
+#include <iostream>
+
+using namespace std;
+
+// Compose left with right and check that the shared alphabet registry
+// has the same symbols afterwards as after reading the inputs.
+
+FrozenTransducer* readFile(const char* fname)
+{
+  FILE* in = fopen(fname, "rb");
+  if(!in) {
+    std::cerr << "Error: Cannot open file '" << fname << "' for reading." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  FrozenTransducer* t = readFrozenBin(in);
+  fclose(in);
+  return t;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc != 5) {
+    cout << "USAGE: " << basename(argv[0]) << " left right left_tape right_tape" << endl;
+    exit(EXIT_FAILURE);
+  }
+  FrozenTransducer* left = readFile(argv[1]);
+  FrozenTransducer* right = readFile(argv[2]);
+  if(!left->getSharedAlphabet() || !right->getSharedAlphabet()) {
+    std::cerr << "Error: The inputs do not share an alphabet." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  vector<pair<UnicodeString, UnicodeString>> tapes = {make_pair(UnicodeString(argv[3]), UnicodeString(argv[4]))};
+
+  size_t before = sharedAlphabet(SymbolTable())->getSymbols().size();
+  Composer comp(left, right, tapes);
+  Transducer* t = comp.compose();
+  size_t after = sharedAlphabet(SymbolTable())->getSymbols().size();
+  cout << "registry: " << before << " -> " << after << " symbols" << endl;
+  delete t;
+  delete left;
+  delete right;
+  return (before == after ? 0 : 1);
+}
@@ -12,13 +12,20 @@ void endProgram(char *name)
   if(name != NULL)
   {
     cout << basename(name) << ": compile a transducer from ATT format" << endl;
-    cout << "USAGE: " << basename(name) << " [transducer [output_file]]" << endl;
+    cout << "USAGE: " << basename(name) << " [-r registry] [-O] [transducer [output_file]]" << endl;
+    cout << "  -r uses the alphabet of this compiled transducer and shares it with" << endl;
+    cout << "     everything else compiled against it, so they can be composed" << endl;
+    cout << "     without merging alphabets, as long as every symbol is in the registry" << endl;
+    cout << "  -O numbers symbols by how often they occur, to make the output smaller" << endl;
   }
   exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[])
 {
+  string registry;
+  bool reorder = false;
+
   #if HAVE_GETOPT_LONG
   int option_index=0;
 #endif
@@ -27,19 +34,29 @@ int main(int argc, char *argv[])
 #if HAVE_GETOPT_LONG
     static struct option long_options[] =
     {
+      {"registry",  required_argument, 0, 'r'},
+      {"order",     no_argument,       0, 'O'},
       {"help",      no_argument, 0, 'h'},
       {0, 0, 0, 0}
     };
 
-    int cnt=getopt_long(argc, argv, "h", long_options, &option_index);
+    int cnt=getopt_long(argc, argv, "r:Oh", long_options, &option_index);
 #else
-    int cnt=getopt(argc, argv, "h");
+    int cnt=getopt(argc, argv, "r:Oh");
 #endif
     if (cnt==-1)
       break;
 
     switch (cnt)
     {
+      case 'r':
+        registry = optarg;
+        break;
+
+      case 'O':
+        reorder = true;
+        break;
+
       case 'h': // fallthrough
       default:
         endProgram(argv[0]);
@@ -49,8 +66,40 @@ int main(int argc, char *argv[])
 
   #include "tools/cli/get_io_txt2fst.cc"
 
-  Transducer* t = readATT(input);
-  writeBin(t, output);
+  if(reorder && !registry.empty()) {
+    cout << "Cannot use -O with -r, since that would renumber the shared symbols" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::shared_ptr<SymbolTable> alphabet;
+  if(!registry.empty()) {
+    FILE* in = fopen(registry.c_str(), "rb");
+    if(!in) {
+      std::cerr << "Error: Cannot open file '" << registry << "' for reading." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    Transducer* reg = readBin(in);
+    fclose(in);
+    alphabet = sharedAlphabet(reg->getAlphabet());
+    delete reg;
+    if(!alphabet) {
+      std::cerr << "Error: The alphabet of '" << registry << "' cannot be shared." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  size_t names = (alphabet ? alphabet->getSymbols().size() : 0);
+  size_t defined = (alphabet ? alphabet->getDefined().size() : 0);
+  Transducer* t = readATT(input, alphabet);
+  // Symbols which aren't in the registry get ids which another
+  // transducer compiled against it might give to something else.
+  if(alphabet && (alphabet->getSymbols().size() != names ||
+                  alphabet->getDefined().size() != defined)) {
+    std::cerr << "Warning: Some symbols are not in '" << registry;
+    std::cerr << "', so the alphabet will not be shared." << std::endl;
+    t->unshareAlphabet();
+  }
+  writeBin(t, output, reorder);
 
   u_fclose(input);
   if(output != stdout) {
@@ -3,15 +3,26 @@ import subprocess
 import unittest
 import tempfile
 import shutil
+import os
 
 class TestBase:
     src_path = '../src/tools/'
     def run_cmd(self, cmd, input_text=None):
         cmd2 = [TestBase.src_path + cmd[0]] + cmd[1:]
         return subprocess.check_output(cmd2, input=input_text, universal_newlines=True)
+    def run_cmd_stderr(self, cmd, input_text=None):
+        cmd2 = [TestBase.src_path + cmd[0]] + cmd[1:]
+        return subprocess.run(cmd2, input=input_text, universal_newlines=True,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, check=True).stderr
     def failed_command(self, cmd, input_text=None):
         with self.assertRaises(subprocess.CalledProcessError):
             self.run_cmd(cmd, input_text)
+    def failed_command_message(self, cmd, message):
+        cmd2 = [TestBase.src_path + cmd[0]] + cmd[1:]
+        proc = subprocess.run(cmd2, universal_newlines=True,
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        self.assertEqual(1, proc.returncode)
+        self.assertIn(message, proc.stdout + proc.stderr)
     def match_output(self, cmd, input_text=None, output_text=''):
         self.maxDiff = None
         actual = self.run_cmd(cmd, input_text)
@@ -34,15 +45,27 @@ class TestBase:
         self.match_sorted_output(cmd, it, ot)
 
 class TestCompose(TestBase, unittest.TestCase):
-    def compose(self, f1, f2, tapes, result_att=None, result_text=None):
+    def compose(self, f1, f2, tapes, result_att=None, result_text=None, then=[], args=[], registry=None, report=[]):
         tmp = tempfile.mkdtemp()
         try:
-            self.run_cmd(['fsnt-txt2fst', f1, tmp + '/f1.bin'])
-            self.run_cmd(['fsnt-txt2fst', f2, tmp + '/f2.bin'])
-            cmd = ['fsnt-compose']
+            txt2fst = ['fsnt-txt2fst']
+            if registry:
+                self.run_cmd(['fsnt-txt2fst', registry, tmp + '/registry.bin'])
+                txt2fst += ['-r', tmp + '/registry.bin']
+            self.run_cmd(txt2fst + [f1, tmp + '/f1.bin'])
+            self.run_cmd(txt2fst + [f2, tmp + '/f2.bin'])
+            cmd = ['fsnt-compose'] + args
             for t1, t2 in tapes:
                 cmd += ['-g', t1, t2]
-            self.run_cmd(cmd + [tmp + '/f1.bin', tmp + '/f2.bin', tmp + '/out.bin'])
+            for i, (f, then_tapes) in enumerate(then):
+                name = tmp + '/then%d.bin' % i
+                self.run_cmd(txt2fst + [f, name])
+                cmd += ['-t', name]
+                for t1, t2 in then_tapes:
+                    cmd += ['-g', t1, t2]
+            err = self.run_cmd_stderr(cmd + [tmp + '/f1.bin', tmp + '/f2.bin', tmp + '/out.bin'])
+            for line in report:
+                self.assertIn(line, err)
             if result_att:
                 self.match_sorted_output_file(['fsnt-fst2txt', tmp + '/out.bin'], output_text=result_att)
             if result_text:
@@ -58,6 +81,205 @@ class TestCompose(TestBase, unittest.TestCase):
                      [('lex_in', 'rule_in'), ('lex_out', 'rule_out')],
                      result_att='compose/result_simple_identity_multi.att',
                      result_text='compose/result_simple2.txt')
+    def test_cascade(self):
+        self.compose('compose/lex_simple_identity.att', 'compose/rule_simple_identity.att',
+                     [('lex_out', 'rule_in')],
+                     then=[('compose/rule2_simple_identity_epsilon.att', [('rule_out', 'r2_in')])],
+                     result_text='compose/result_cascade.txt')
+        # the limits apply to the lazy first step as well as the last one
+        self.compose('compose/lex_simple_identity.att', 'compose/rule_simple_identity.att',
+                     [('lex_out', 'rule_in')],
+                     then=[('compose/rule2_simple_identity_epsilon.att', [('rule_out', 'r2_in')])],
+                     args=['-N', '5', '-A', '100', '-B', '10'],
+                     result_text='compose/result_cascade.txt')
+        # the last step only reaches one branch of the first,
+        # which has 26 states, so the first mustn't be fully expanded
+        self.compose('compose/lex_branches.att', 'compose/rule_any.att',
+                     [('lex_out', 'rule_in')],
+                     then=[('compose/rule2_simple_identity_epsilon.att', [('rule_out', 'r2_in')])],
+                     args=['-N', '15'], result_text='compose/result_branches.txt')
+    def test_keep_tapes(self):
+        self.compose('compose/lex_simple_identity.att', 'compose/rule_simple_identity.att',
+                     [('lex_out', 'rule_in')],
+                     then=[('compose/rule2_simple_identity_epsilon.att', [('rule_out', 'r2_in')])],
+                     args=['-k', 'lex_in', '-k', 'r2_out'],
+                     result_text='compose/result_keep.txt')
+    def test_symbol_types(self):
+        self.compose('compose/lex_symbol_types.att', 'compose/rule_symbol_types.att',
+                     [('l_out', 'r_in')], result_text='compose/result_symbol_types.txt')
+    def test_left_identity(self):
+        # @_ID_0_@ on l_out is whatever l_in is, so @_UPPER_@ becomes A
+        for j in ['auto', 'nested', 'indexed', 'merge']:
+            self.compose('compose/lex_left_identity.att', 'compose/rule_left_identity.att',
+                         [('l_out', 'r_in')], args=['-J', j],
+                         result_text='compose/result_left_identity.txt')
+    def test_flags(self):
+        self.compose('compose/lex_flags.att', 'compose/rule_flags.att',
+                     [('l_in', 'r_in')], args=['-F'],
+                     result_text='compose/result_flags.txt')
+        # @D.X.A@ blocks the path once X is known to be A
+        self.compose('compose/lex_flags_disallow.att', 'compose/rule_flags.att',
+                     [('l_in', 'r_in')], args=['-F'],
+                     result_text='compose/result_flags_disallow.txt')
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_flags_disallow.att', tmp + '/in.bin'])
+            self.run_cmd(['fsnt-optimize-flags', tmp + '/in.bin', tmp + '/out.bin'])
+            self.match_sorted_output_file(['fsnt-expand', tmp + '/out.bin'],
+                                          output_text='compose/result_optimize_disallow.txt')
+        finally:
+            shutil.rmtree(tmp)
+    def test_shared_alphabet(self):
+        self.compose('compose/lex_symbol_types.att', 'compose/rule_symbol_types.att',
+                     [('l_out', 'r_in')], result_text='compose/result_symbol_types.txt',
+                     registry='compose/lex_symbol_types.att')
+    def test_shared_alphabet_identity(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/registry_symbol_types.att', tmp + '/registry.bin'])
+            for f in ['lex', 'rule']:
+                err = self.run_cmd_stderr(['fsnt-txt2fst', '-r', tmp + '/registry.bin',
+                                           'compose/%s_symbol_types.att' % f, tmp + '/%s.bin' % f])
+                self.assertNotIn('will not be shared', err)
+            # @_ID_0_@ on r_out becomes @_ID_1_@, which isn't in the registry
+            self.run_cmd(['test-shared-registry', tmp + '/lex.bin', tmp + '/rule.bin', 'l_out', 'r_in'])
+        finally:
+            shutil.rmtree(tmp)
+        self.compose('compose/lex_symbol_types.att', 'compose/rule_symbol_types.att',
+                     [('l_out', 'r_in')], result_text='compose/result_symbol_types.txt',
+                     registry='compose/registry_symbol_types.att')
+    def test_shared_alphabet_grown(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/registry_partial.att', tmp + '/registry.bin'])
+            self.run_cmd(['fsnt-txt2fst', '-r', tmp + '/registry.bin', 'compose/registry_partial.att', tmp + '/same.bin'])
+            with open(tmp + '/same.bin', 'rb') as fin:
+                features = int.from_bytes(fin.read(12)[4:], 'big')
+            self.assertEqual(2, features & 2)
+            for f in ['lex', 'rule']:
+                err = self.run_cmd_stderr(['fsnt-txt2fst', '-r', tmp + '/registry.bin',
+                                           'compose/%s_symbol_types.att' % f, tmp + '/%s.bin' % f])
+                self.assertIn('will not be shared', err)
+                with open(tmp + '/%s.bin' % f, 'rb') as fin:
+                    features = int.from_bytes(fin.read(12)[4:], 'big')
+                self.assertEqual(0, features & 2)
+            self.run_cmd(['fsnt-compose', '-g', 'l_out', 'r_in', tmp + '/lex.bin', tmp + '/rule.bin', tmp + '/out.bin'])
+            self.match_sorted_output_file(['fsnt-expand', tmp + '/out.bin'],
+                                          output_text='compose/result_symbol_types.txt')
+        finally:
+            shutil.rmtree(tmp)
+    def test_epsilon_filters(self):
+        for f in ['sequence', 'match']:
+            self.compose('compose/lex_epsilon_run.att', 'compose/rule_epsilon_run.att',
+                         [('l_out', 'r_in')], args=['-f', f],
+                         result_text='compose/result_epsilon_run.txt')
+
+    def test_trim(self):
+        self.compose('compose/lex_simple_identity.att', 'compose/rule_trim.att',
+                     [('lex_out', 'rule_in')], args=['-T'],
+                     result_att='compose/result_trim.att')
+    def test_trim_empty(self):
+        self.compose('compose/rule_trim.att', 'compose/rule2_trim_empty.att',
+                     [('rule_out', 'r2_in')], args=['-T'],
+                     result_att='compose/result_trim_empty.att')
+    def test_prune(self):
+        self.compose('compose/lex_weighted.att', 'compose/rule_weighted.att',
+                     [('l_out', 'r_in')], args=['-w', '3'],
+                     result_text='compose/result_prune.txt')
+        self.compose('compose/lex_weighted.att', 'compose/rule_weighted.att',
+                     [('l_out', 'r_in')], args=['-w', '10'],
+                     result_text='compose/result_weighted.txt')
+    def test_threads(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            for f1, f2, tapes in [('lex_simple_identity', 'rule_simple_identity', ['lex_out', 'rule_in']),
+                                  ('lex_symbol_types', 'rule_symbol_types', ['l_out', 'r_in']),
+                                  ('lex_epsilon_run', 'rule_epsilon_run', ['l_out', 'r_in'])]:
+                self.run_cmd(['fsnt-txt2fst', 'compose/%s.att' % f1, tmp + '/f1.bin'])
+                self.run_cmd(['fsnt-txt2fst', 'compose/%s.att' % f2, tmp + '/f2.bin'])
+                cmd = ['fsnt-compose', '-g'] + tapes
+                inputs = [tmp + '/f1.bin', tmp + '/f2.bin']
+                self.run_cmd(cmd + inputs + [tmp + '/serial.bin'])
+                self.run_cmd(cmd + ['-j', '3'] + inputs + [tmp + '/parallel.bin'])
+                with open(tmp + '/serial.bin', 'rb') as s, open(tmp + '/parallel.bin', 'rb') as p:
+                    self.assertEqual(s.read(), p.read())
+        finally:
+            shutil.rmtree(tmp)
+    def test_spill(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_simple_identity.att', tmp + '/f1.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/rule_trim.att', tmp + '/f2.bin'])
+            cmd = ['fsnt-compose', '-g', 'lex_out', 'rule_in']
+            inputs = [tmp + '/f1.bin', tmp + '/f2.bin']
+            self.run_cmd(cmd + inputs + [tmp + '/memory.bin'])
+            self.run_cmd(cmd + ['-s', tmp, '-S', '1'] + inputs + [tmp + '/spill.bin'])
+            with open(tmp + '/memory.bin', 'rb') as f1, open(tmp + '/spill.bin', 'rb') as f2:
+                self.assertEqual(f1.read(), f2.read())
+            self.failed_command(cmd + ['-s', tmp, '-S', '1', '-N', '2'] + inputs + [tmp + '/limited.bin'])
+            self.assertFalse(os.path.exists(tmp + '/limited.bin'))
+        finally:
+            shutil.rmtree(tmp)
+    def test_limits(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_epsilon_run.att', tmp + '/f1.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/rule_epsilon_run.att', tmp + '/f2.bin'])
+            cmd = ['fsnt-compose', '-g', 'l_out', 'r_in']
+            inputs = [tmp + '/f1.bin', tmp + '/f2.bin', tmp + '/out.bin']
+            self.failed_command_message(cmd + ['-N', '3'] + inputs,
+                                        'Composition exceeded the limit of 3 states after 5 states')
+            self.failed_command_message(cmd + ['-A', '3'] + inputs,
+                                        'Composition exceeded the limit of 3 transitions after 5 states and 4 transitions')
+            self.failed_command_message(cmd + ['-A', '3', '-s', tmp] + inputs,
+                                        'Composition exceeded the limit of 3 transitions')
+            self.failed_command_message(cmd + ['-N', '3', '-t', tmp + '/f2.bin', '-g', 'r_out', 'r_in'] + inputs,
+                                        'Composition exceeded the limit of 3 states after 5 states')
+            self.assertFalse(os.path.exists(tmp + '/out.bin'))
+            self.run_cmd(cmd + ['-f', 'sequence', '-N', '100', '-A', '100', '-M', '4096'] + inputs)
+            self.match_sorted_output_file(['fsnt-expand', tmp + '/out.bin'], output_text='compose/result_epsilon_run.txt')
+
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_lag.att', tmp + '/f1.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/rule_lag.att', tmp + '/f2.bin'])
+            cmd = ['fsnt-compose', '-g', 'l_in', 'r_in', '-g', 'l_out', 'r_out']
+            self.failed_command_message(cmd + ['-B', '1'] + inputs,
+                                        "The longest backlog has 2 symbols on tape 'r_out' of the right transducer")
+            self.run_cmd(cmd + ['-B', '2'] + inputs)
+
+            # memory is only checked every 256 states
+            with open(tmp + '/chain.att', 'w') as f:
+                f.write('# tapes:\tin\tout\n')
+                for i in range(300):
+                    f.write('%d\t%d\ta\ta\n' % (i, i + 1))
+                f.write('300\n')
+            self.run_cmd(['fsnt-txt2fst', tmp + '/chain.att', tmp + '/f1.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/rule_lag.att', tmp + '/f2.bin'])
+            self.failed_command_message(['fsnt-compose', '-g', 'out', 'r_in', '-M', '1'] + inputs,
+                                        'MB of memory')
+        finally:
+            shutil.rmtree(tmp)
+    def test_recompose(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_simple_identity.att', tmp + '/before.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/lex_simple_identity_changed.att', tmp + '/after.bin'])
+            self.run_cmd(['fsnt-txt2fst', 'compose/rule_trim.att', tmp + '/rule.bin'])
+            self.run_cmd(['test-recompose', tmp + '/before.bin', tmp + '/after.bin', tmp + '/rule.bin',
+                          'lex_out', 'rule_in', tmp + '/recomposed.bin', '2'])
+            self.run_cmd(['fsnt-compose', '-T', '-g', 'lex_out', 'rule_in',
+                          tmp + '/after.bin', tmp + '/rule.bin', tmp + '/composed.bin'])
+            expected = self.run_cmd(['fsnt-expand', tmp + '/composed.bin'])
+            self.assertIn('qnd', expected)
+            self.match_sorted_output(['fsnt-expand', tmp + '/recomposed.bin'], output_text=expected)
+        finally:
+            shutil.rmtree(tmp)
+    def test_join_plan(self):
+        for j in ['auto', 'nested', 'indexed', 'merge']:
+            self.compose('compose/lex_simple_identity.att', 'compose/rule_simple_identity_epsilon.att',
+                         [('lex_out', 'rule_in')], args=['-J', j, '-P'],
+                         result_text='compose/result_simple3.txt',
+                         report=['left: 5 states, 6 transitions, fan-out 1.2 average, 3 max, deterministic and sorted',
+                                 'right: 3 states, 7 transitions, fan-out 2.33333 average, 5 max, nondeterministic'])
 
 class TestReverse(TestBase, unittest.TestCase):
     def reverse(self, f, result_att=None, result_text=None):
@@ -74,5 +296,34 @@ class TestReverse(TestBase, unittest.TestCase):
     def test_unweighted(self):
         self.reverse('reverse/simple_unweighted_in.att', result_att='reverse/simple_unweighted_out.att')
 
+class TestTxt2fst(TestBase, unittest.TestCase):
+    def test_order_symbols(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            for f in ['compose/lex_symbol_types.att', 'compose/rule_symbol_types.att',
+                      'compose/lex_flags.att', 'reverse/simple_unweighted_in.att']:
+                self.run_cmd(['fsnt-txt2fst', f, tmp + '/plain.bin'])
+                self.run_cmd(['fsnt-txt2fst', '-O', f, tmp + '/ordered.bin'])
+                expected = self.run_cmd(['fsnt-expand', tmp + '/plain.bin'])
+                self.match_sorted_output(['fsnt-expand', tmp + '/ordered.bin'], output_text=expected)
+        finally:
+            shutil.rmtree(tmp)
+    def test_bad_target(self):
+        tmp = tempfile.mkdtemp()
+        try:
+            with open(tmp + '/one.att', 'w') as fout:
+                fout.write('0\t1\ta\n1\n')
+            self.run_cmd(['fsnt-txt2fst', tmp + '/one.att', tmp + '/one.bin'])
+            with open(tmp + '/one.bin', 'rb') as fin:
+                data = bytearray(fin.read())
+            # 2 states, then state 0 has 1 group of 1 arc to state 1
+            loc = data.rindex(b'\x02\x01\x01\x01') + 2
+            data[loc] = 5
+            with open(tmp + '/bad.bin', 'wb') as fout:
+                fout.write(data)
+            self.failed_command(['fsnt-fst2txt', tmp + '/bad.bin'])
+        finally:
+            shutil.rmtree(tmp)
+
 if __name__ == '__main__':
     unittest.main(buffer=True, verbosity=2)